@@ -58,12 +58,53 @@
 /* Opaque struct representing a HashX instance */
 typedef struct hashx_ctx hashx_ctx;
 
+/* Opaque struct representing a shared arena for compiled code */
+typedef struct hashx_arena hashx_arena;
+
+/* Opaque struct representing a generated HashX function */
+typedef struct hashx_func hashx_func;
+
+/* Opaque struct representing a cache of HashX instances */
+typedef struct hashx_cache hashx_cache;
+
+/* Opaque struct representing the absorbed prefix of seeds */
+typedef struct hashx_prefix hashx_prefix;
+
+/* Opaque struct representing a block mode input absorbed in parts */
+typedef struct hashx_stream hashx_stream;
+
+/* Fragment of a block mode input */
+typedef struct hashx_iovec {
+    const void* base;
+    size_t size;
+} hashx_iovec;
+
 /* Type of hash function */
 typedef enum hashx_type {
     HASHX_INTERPRETED,
     HASHX_COMPILED
 } hashx_type;
 
+/* Metrics of the program of a HashX instance */
+typedef struct hashx_program_info {
+    unsigned code_size;      /* number of instructions */
+    unsigned x86_size;       /* size of the x86 code in bytes */
+    unsigned mul_count;      /* number of multiplications */
+    unsigned wide_mul_count; /* number of 64x64->128 bit multiplications */
+    unsigned branch_count;   /* number of branch instructions */
+    unsigned cpu_latency;    /* latency in cycles on the modeled CPU */
+    unsigned asic_latency;   /* latency with unlimited parallelism */
+    double ipc;              /* instructions per cycle on the modeled CPU */
+} hashx_program_info;
+
+/* Counters of a HashX instance */
+typedef struct hashx_stats {
+    uint64_t makes;          /* functions created */
+    uint64_t rejected;       /* seeds rejected by hashx_make */
+    uint64_t execs;          /* hashes calculated */
+    uint64_t branches_taken; /* branches taken by the programs */
+} hashx_stats;
+
 /* Sentinel value used to indicate unsupported type */
 #define HASHX_NOTSUPP ((hashx_ctx*)-1)
 
@@ -104,6 +145,54 @@ extern "C" {
 */
 HASHX_API hashx_ctx* hashx_alloc(hashx_type type);
 
+/*
+ * Allocate an arena for the code of compiled HashX instances. Instead of
+ * mapping its own memory, each instance allocated in the arena uses a slot
+ * of a large shared mapping. The arena is not thread-safe.
+ *
+ * @param capacity is the number of instances that can be allocated before
+ *        the arena has to map more memory. The initial mapping is
+ *        pre-faulted.
+ *
+ * @return pointer to a new arena or NULL on memory allocation failure.
+*/
+HASHX_API hashx_arena* hashx_arena_alloc(size_t capacity);
+
+/*
+ * Allocate a HashX instance that stores its compiled code in an arena.
+ *
+ * @param type is the type of instance to be created. The arena is not used
+ *        by interpreted instances.
+ * @param arena is pointer to an arena.
+ *
+ * @return same as hashx_alloc.
+*/
+HASHX_API hashx_ctx* hashx_alloc_arena(hashx_type type, hashx_arena* arena);
+
+/*
+ * Make the whole arena writable to create many HashX functions with
+ * a single protection change. Instances allocated in the arena can be
+ * created with hashx_make, but must not be executed until
+ * hashx_arena_end is called.
+ *
+ * @param arena is pointer to an arena.
+*/
+HASHX_API void hashx_arena_begin(hashx_arena* arena);
+
+/*
+ * Make the whole arena executable again after hashx_arena_begin.
+ *
+ * @param arena is pointer to an arena.
+*/
+HASHX_API void hashx_arena_end(hashx_arena* arena);
+
+/*
+ * Free an arena. All instances allocated in the arena must have been freed.
+ *
+ * @param arena is pointer to an arena.
+*/
+HASHX_API void hashx_arena_free(hashx_arena* arena);
+
 /*
  * Create a new HashX function from seed.
  *
@@ -115,6 +204,129 @@ HASHX_API hashx_ctx* hashx_alloc(hashx_type type);
 */
 HASHX_API int hashx_make(hashx_ctx* ctx, const void* seed, size_t size);
 
+/*
+ * Allocate storage for a seed prefix.
+ *
+ * @return pointer to the new storage or NULL on memory allocation failure.
+*/
+HASHX_API hashx_prefix* hashx_prefix_alloc(void);
+
+/*
+ * Absorb the common prefix of seeds. Seeds that start with the prefix
+ * can then be processed by hashx_make_prefix without hashing the prefix
+ * again. Any previous prefix is replaced.
+ *
+ * @param prefix is pointer to storage allocated by hashx_prefix_alloc.
+ * @param data is a pointer to the prefix.
+ * @param size is the size of the prefix.
+*/
+HASHX_API void hashx_prefix_set(hashx_prefix* prefix, const void* data,
+    size_t size);
+
+/*
+ * Create a new HashX function from a seed that consists of an absorbed
+ * prefix followed by a suffix. This is equivalent to hashx_make with the
+ * concatenated seed. The prefix is not modified and can be used by
+ * multiple threads at the same time.
+ *
+ * @param ctx is pointer to a HashX instance.
+ * @param prefix is pointer to an absorbed prefix.
+ * @param suffix is a pointer to the rest of the seed.
+ * @param size is the size of the suffix.
+ *
+ * @return 1 on success, 0 on failure.
+*/
+HASHX_API int hashx_make_prefix(hashx_ctx* ctx, const hashx_prefix* prefix,
+    const void* suffix, size_t size);
+
+/*
+ * Free a seed prefix.
+ *
+ * @param prefix is pointer to a seed prefix.
+*/
+HASHX_API void hashx_prefix_free(hashx_prefix* prefix);
+
+/*
+ * Create n HashX functions from n seeds, distributing the work among
+ * a number of threads. This is equivalent to calling hashx_make for
+ * each instance. All instances must be distinct.
+ *
+ * @param ctxs is an array of n pointers to HashX instances.
+ * @param seeds is an array of n pointers to the seed values.
+ * @param seed_lens is an array of the n seed sizes.
+ * @param n is the number of instances to create.
+ * @param status_out is an optional array of n values that receive the
+ *        result of hashx_make for each instance (1 on success, 0 if the
+ *        seed was rejected). Can be NULL.
+ * @param threads is the maximum number of threads to use, including
+ *        the calling thread. Values 0 and 1 create all instances on
+ *        the calling thread.
+ *
+ * @return the number of successfully created instances.
+*/
+HASHX_API size_t hashx_make_many(hashx_ctx* const ctxs[],
+    const void* const seeds[], const size_t seed_lens[], size_t n,
+    int status_out[], unsigned threads);
+
+/*
+ * Allocate storage for a generated HashX function. It can be used to
+ * generate functions separately from the instances that execute them,
+ * for example on another thread.
+ *
+ * @return pointer to the new storage or NULL on memory allocation failure.
+*/
+HASHX_API hashx_func* hashx_func_alloc(void);
+
+/*
+ * Generate a HashX function from seed without compiling it. This is the
+ * first stage of hashx_make and does not access the memory of any
+ * HashX instance.
+ *
+ * @param func is pointer to storage allocated by hashx_func_alloc.
+ * @param seed is a pointer to the seed value.
+ * @param size is the size of the seed.
+ *
+ * @return 1 on success, 0 if the seed is rejected (hashx_make would fail).
+*/
+HASHX_API int hashx_generate(hashx_func* func, const void* seed, size_t size);
+
+/*
+ * Attach a generated HashX function to an instance. This is the second
+ * stage of hashx_make: compiled instances compile the function, while
+ * interpreted instances copy it. The instance is then in the same state
+ * as after hashx_make with the same seed. The generated function is not
+ * modified and can be attached to any number of instances.
+ *
+ * @param ctx is pointer to a HashX instance.
+ * @param func is pointer to a function generated by hashx_generate.
+*/
+HASHX_API void hashx_attach(hashx_ctx* ctx, const hashx_func* func);
+
+/*
+ * Copy the HashX function of an instance to another instance of the same
+ * type without generating or compiling it again. Compiled code only uses
+ * relative addresses, so it is copied as is. The destination is then in
+ * the same state as after hashx_make with the seed of the source.
+ *
+ * A single instance can also be shared by several threads directly:
+ * hashx_exec, hashx_exec_batch and hashx_search don't modify the instance
+ * and may be called concurrently as long as no thread calls hashx_make
+ * or hashx_free on it at the same time. A clone gives a thread its own
+ * copy that can be remade or freed independently of the source.
+ *
+ * @param ctx is pointer to the destination HashX instance.
+ * @param source is pointer to a HashX instance of the same type with
+ *        a function created by hashx_make.
+*/
+HASHX_API void hashx_clone(hashx_ctx* ctx, const hashx_ctx* source);
+
+/*
+ * Free a generated HashX function.
+ *
+ * @param func is pointer to a generated HashX function.
+*/
+HASHX_API void hashx_func_free(hashx_func* func);
+
 /*
  * Execute the HashX function.
  *
@@ -126,6 +338,216 @@ HASHX_API int hashx_make(hashx_ctx* ctx, const void* seed, size_t size);
  s*/
 HASHX_API void hashx_exec(const hashx_ctx* ctx, HASHX_INPUT, void* output);
 
+#ifndef HASHX_BLOCK_MODE
+/*
+ * Execute the HashX function for a range of consecutive nonces.
+ * Produces the same results as calling hashx_exec for each nonce, but
+ * with a higher throughput.
+ *
+ * @param ctx is pointer to a HashX instance. A HashX function must have
+ *        been previously created by calling hashx_make.
+ * @param first_nonce is the first nonce to be hashed.
+ * @param count is the number of nonces to be hashed.
+ * @param output is a pointer to the result buffer. count * HASHX_SIZE bytes
+ *        will be written. The hash of nonce (first_nonce + i) is stored
+ *        at offset i * HASHX_SIZE.
+*/
+HASHX_API void hashx_exec_batch(const hashx_ctx* ctx, uint64_t first_nonce,
+    size_t count, void* output);
+
+/*
+ * Search a range of consecutive nonces for hashes below a target.
+ * The first 8 bytes of each hash (or all HASHX_SIZE bytes if the hash is
+ * shorter) are interpreted as a little-endian integer and compared with
+ * the target. Only the matching nonces are returned, so the full hash
+ * output is never stored.
+ *
+ * @param ctx is pointer to a HashX instance. A HashX function must have
+ *        been previously created by calling hashx_make.
+ * @param start is the first nonce to be hashed.
+ * @param count is the number of nonces to be hashed.
+ * @param target is the exclusive upper bound of the hash value.
+ * @param results is a pointer to an array of max_results nonces. The
+ *        matching nonces are stored in ascending order.
+ * @param max_results is the capacity of the results array. The search
+ *        stops once it has been filled.
+ *
+ * @return the number of nonces stored in results.
+*/
+HASHX_API size_t hashx_search(const hashx_ctx* ctx, uint64_t start,
+    size_t count, uint64_t target, uint64_t* results, size_t max_results);
+#else
+/*
+ * Execute the HashX function for a number of independent inputs.
+ * Produces the same results as calling hashx_exec for each input, but
+ * with a higher throughput: the inputs are absorbed by a multi-buffer
+ * Blake2b that processes 4 (AVX2) or 8 (AVX-512) inputs in parallel.
+ * Inputs of different sizes can be mixed.
+ *
+ * @param ctx is pointer to a HashX instance. A HashX function must have
+ *        been previously created by calling hashx_make.
+ * @param inputs is an array of count pointers to the inputs.
+ * @param sizes is an array of the count input sizes.
+ * @param count is the number of inputs to be hashed.
+ * @param output is a pointer to the result buffer. count * HASHX_SIZE bytes
+ *        will be written. The hash of inputs[i] is stored at offset
+ *        i * HASHX_SIZE.
+*/
+HASHX_API void hashx_exec_many(const hashx_ctx* ctx,
+    const void* const inputs[], const size_t sizes[], size_t count,
+    void* output);
+
+/*
+ * Execute the HashX function for an input that consists of several
+ * fragments. This is equivalent to hashx_exec with the concatenated
+ * fragments, but the fragments are hashed in place. Only the partial
+ * Blake2b blocks at the fragment boundaries are copied.
+ *
+ * @param ctx is pointer to a HashX instance. A HashX function must have
+ *        been previously created by calling hashx_make.
+ * @param iov is an array of count fragments of the input.
+ * @param count is the number of fragments.
+ * @param output is a pointer to the result buffer. HASHX_SIZE bytes will be
+ *        written.
+*/
+HASHX_API void hashx_exec_iov(const hashx_ctx* ctx, const hashx_iovec iov[],
+    size_t count, void* output);
+
+/*
+ * Allocate storage for an input that is absorbed in parts.
+ *
+ * @return pointer to the new storage or NULL on memory allocation failure.
+*/
+HASHX_API hashx_stream* hashx_stream_alloc(void);
+
+/*
+ * Start absorbing a new input for a HashX instance. The instance must not
+ * be remade or freed until hashx_stream_final is called.
+ *
+ * @param stream is pointer to storage allocated by hashx_stream_alloc.
+ * @param ctx is pointer to a HashX instance. A HashX function must have
+ *        been previously created by calling hashx_make.
+*/
+HASHX_API void hashx_stream_init(hashx_stream* stream, const hashx_ctx* ctx);
+
+/*
+ * Absorb the next part of the input. The data is not referenced after
+ * the call returns.
+ *
+ * @param stream is pointer to a stream initialized by hashx_stream_init.
+ * @param data is a pointer to the next part of the input.
+ * @param size is the size of the part.
+*/
+HASHX_API void hashx_stream_update(hashx_stream* stream, const void* data,
+    size_t size);
+
+/*
+ * Execute the HashX function for the absorbed input. The result is the
+ * same as hashx_exec with the concatenated parts. The stream must be
+ * initialized again before it absorbs another input.
+ *
+ * @param stream is pointer to a stream initialized by hashx_stream_init.
+ * @param output is a pointer to the result buffer. HASHX_SIZE bytes will be
+ *        written.
+*/
+HASHX_API void hashx_stream_final(hashx_stream* stream, void* output);
+
+/*
+ * Free storage allocated by hashx_stream_alloc.
+ *
+ * @param stream is pointer to the storage.
+*/
+HASHX_API void hashx_stream_free(hashx_stream* stream);
+#endif
+
+/*
+ * Allocate a thread-safe cache of HashX instances indexed by seed.
+ *
+ * @param type is the type of instances to be created.
+ * @param capacity is the maximum number of instances kept in the cache.
+ *        The least recently used instances are evicted first. Caches with
+ *        a capacity of 32 or more are split into up to 16 shards by seed,
+ *        and the eviction order is then kept within each shard.
+ *
+ * @return pointer to a new cache. Returns NULL on memory allocation failure
+ *         or if the requested type is not supported.
+*/
+HASHX_API hashx_cache* hashx_cache_alloc(hashx_type type, size_t capacity);
+
+/*
+ * Get a HashX instance for a seed from the cache. If the seed is not
+ * cached, a new instance is created as if by hashx_make. The instance
+ * must be returned by calling hashx_cache_release and must not be passed
+ * to hashx_make or hashx_free. It remains valid until it is released,
+ * even if it is evicted from the cache in the meantime.
+ *
+ * @param cache is pointer to a cache.
+ * @param seed is a pointer to the seed value.
+ * @param size is the size of the seed.
+ *
+ * @return pointer to a ready HashX instance. Returns NULL on memory
+ *         allocation failure or if hashx_make would fail for the seed.
+*/
+HASHX_API hashx_ctx* hashx_cache_get(hashx_cache* cache, const void* seed,
+    size_t size);
+
+/*
+ * Release a HashX instance obtained from hashx_cache_get.
+ *
+ * @param cache is pointer to a cache.
+ * @param ctx is pointer to the instance.
+*/
+HASHX_API void hashx_cache_release(hashx_cache* cache, hashx_ctx* ctx);
+
+/*
+ * Get the number of cache hits and misses of hashx_cache_get.
+ *
+ * @param cache is pointer to a cache.
+ * @param hits is a pointer where the number of hits is stored. Can be NULL.
+ * @param misses is a pointer where the number of misses is stored. Can be
+ *        NULL.
+*/
+HASHX_API void hashx_cache_stats(hashx_cache* cache, uint64_t* hits,
+    uint64_t* misses);
+
+/*
+ * Free a cache. All instances must have been released.
+ *
+ * @param cache is pointer to a cache.
+*/
+HASHX_API void hashx_cache_free(hashx_cache* cache);
+
+/*
+ * Get the metrics of the current program of a HashX instance. They are
+ * calculated when the function is created.
+ *
+ * @param ctx is pointer to a HashX instance.
+ * @param info is pointer to the structure that receives the metrics.
+ *
+ * @return 1 on success, 0 if the instance has no function.
+*/
+HASHX_API int hashx_query_program(const hashx_ctx* ctx,
+    hashx_program_info* info);
+
+/*
+ * Enable or disable the counting of hashes and taken branches. Counting
+ * uses atomic operations, so it's disabled by default. Functions created
+ * and rejected seeds are always counted.
+ *
+ * @param ctx is pointer to a HashX instance.
+ * @param enable is nonzero to enable counting.
+*/
+HASHX_API void hashx_stats_enable(hashx_ctx* ctx, int enable);
+
+/*
+ * Get the counters of a HashX instance. This function can be called
+ * concurrently with other functions that use the instance.
+ *
+ * @param ctx is pointer to a HashX instance.
+ * @param stats is pointer to the structure that receives the counters.
+*/
+HASHX_API void hashx_query_stats(const hashx_ctx* ctx, hashx_stats* stats);
+
 /*
  * Free a HashX instance.
  *
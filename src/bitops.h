@@ -0,0 +1,44 @@
+/* Copyright (c) 2020 tevador <tevador@gmail.com> */
+/* See LICENSE for licensing information */
+
+#ifndef BITOPS_H
+#define BITOPS_H
+
+#include <stdint.h>
+#include "force_inline.h"
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+/* index of the least significant set bit, x must not be zero */
+static FORCE_INLINE int hashx_ctz64(uint64_t x) {
+#if defined(__GNUC__) || defined(__clang__)
+	return __builtin_ctzll(x);
+#elif defined(_MSC_VER) && defined(_M_X64)
+	unsigned long index;
+	_BitScanForward64(&index, x);
+	return (int)index;
+#else
+	int index = 0;
+	while (!(x & 1)) {
+		x >>= 1;
+		index++;
+	}
+	return index;
+#endif
+}
+
+/* __builtin_popcount is a library call unless the target has POPCNT */
+static FORCE_INLINE int hashx_popcount32(uint32_t x) {
+#if defined(__POPCNT__)
+	return __builtin_popcount(x);
+#else
+	x = x - ((x >> 1) & 0x55555555);
+	x = (x & 0x33333333) + ((x >> 2) & 0x33333333);
+	x = (x + (x >> 4)) & 0x0f0f0f0f;
+	return (int)((x * 0x01010101) >> 24);
+#endif
+}
+
+#endif
@@ -8,18 +8,15 @@
 */
 
 #include <stdint.h>
+#include <stdbool.h>
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
 
 #include "blake2.h"
+#include "blake2_impl.h"
 #include "hashx_endian.h"
-
-static const uint64_t blake2b_IV[8] = {
-	UINT64_C(0x6a09e667f3bcc908), UINT64_C(0xbb67ae8584caa73b),
-	UINT64_C(0x3c6ef372fe94f82b), UINT64_C(0xa54ff53a5f1d36f1),
-	UINT64_C(0x510e527fade682d1), UINT64_C(0x9b05688c2b3e6c1f),
-	UINT64_C(0x1f83d9abfb41bd6b), UINT64_C(0x5be0cd19137e2179) };
+#include "cpu.h"
 
 #define BLAKE2_SIGMA_0_0 0
 #define BLAKE2_SIGMA_0_1 1
@@ -294,7 +291,7 @@ int hashx_blake2b_init_param(blake2b_state* S, const blake2b_param* P) {
 
 #define ROUND(r) ROUND_INNER(r)
 
-static void blake2b_compress(blake2b_state* S, const uint8_t* block) {
+static void blake2b_compress_ref(blake2b_state* S, const uint8_t* block) {
 	uint64_t m[16];
 	uint64_t v[16];
 	unsigned int i;
@@ -334,7 +331,7 @@ static void blake2b_compress(blake2b_state* S, const uint8_t* block) {
 	}
 }
 
-static void blake2b_compress_4r(blake2b_state* S, const uint8_t* block) {
+static void blake2b_compress_4r_ref(blake2b_state* S, const uint8_t* block) {
 	uint64_t m[16];
 	uint64_t v[16];
 	unsigned int i;
@@ -366,7 +363,49 @@ static void blake2b_compress_4r(blake2b_state* S, const uint8_t* block) {
 	}
 }
 
-int hashx_blake2b_update(blake2b_state* S, const void* in, size_t inlen) {
+/* The SIMD versions compute the four G functions of a step in parallel.
+   They are fastest when the diagonal steps are not on the critical path,
+   see blake2_avx2.c. */
+static FORCE_INLINE bool blake2b_compress_simd(blake2b_state* S,
+	const uint8_t* block, int rounds) {
+#ifdef HASHX_SIMD_X86
+	unsigned features = hashx_cpu_features();
+	if (features & HASHX_CPU_AVX2) {
+		hashx_blake2b_compress_avx2(S, block, rounds);
+		return true;
+	}
+	if (features & HASHX_CPU_SSE41) {
+		hashx_blake2b_compress_sse41(S, block, rounds);
+		return true;
+	}
+#endif
+	return false;
+}
+
+static void blake2b_compress(blake2b_state* S, const uint8_t* block) {
+	if (!blake2b_compress_simd(S, block, 12)) {
+		blake2b_compress_ref(S, block);
+	}
+}
+
+static void blake2b_compress_4r(blake2b_state* S, const uint8_t* block) {
+	if (!blake2b_compress_simd(S, block, 4)) {
+		blake2b_compress_4r_ref(S, block);
+	}
+}
+
+static FORCE_INLINE void blake2b_compress_rounds(blake2b_state* S,
+	const uint8_t* block, int rounds) {
+	if (rounds == 4) {
+		blake2b_compress_4r(S, block);
+	}
+	else {
+		blake2b_compress(S, block);
+	}
+}
+
+static FORCE_INLINE int blake2b_update(blake2b_state* S, const void* in,
+	size_t inlen, int rounds) {
 	const uint8_t* pin = (const uint8_t*)in;
 
 	if (inlen == 0) {
@@ -385,18 +424,20 @@ int hashx_blake2b_update(blake2b_state* S, const void* in, size_t inlen) {
 
 	if (S->buflen + inlen > BLAKE2B_BLOCKBYTES) {
 		/* Complete current block */
-		size_t left = S->buflen;
-		size_t fill = BLAKE2B_BLOCKBYTES - left;
-		memcpy(&S->buf[left], pin, fill);
-		blake2b_increment_counter(S, BLAKE2B_BLOCKBYTES);
-		blake2b_compress(S, S->buf);
-		S->buflen = 0;
-		inlen -= fill;
-		pin += fill;
+		if (S->buflen != 0) {
+			size_t left = S->buflen;
+			size_t fill = BLAKE2B_BLOCKBYTES - left;
+			memcpy(&S->buf[left], pin, fill);
+			blake2b_increment_counter(S, BLAKE2B_BLOCKBYTES);
+			blake2b_compress_rounds(S, S->buf, rounds);
+			S->buflen = 0;
+			inlen -= fill;
+			pin += fill;
+		}
 		/* Avoid buffer copies when possible */
 		while (inlen > BLAKE2B_BLOCKBYTES) {
 			blake2b_increment_counter(S, BLAKE2B_BLOCKBYTES);
-			blake2b_compress(S, pin);
+			blake2b_compress_rounds(S, pin, rounds);
 			inlen -= BLAKE2B_BLOCKBYTES;
 			pin += BLAKE2B_BLOCKBYTES;
 		}
@@ -406,6 +447,10 @@ int hashx_blake2b_update(blake2b_state* S, const void* in, size_t inlen) {
 	return 0;
 }
 
+int hashx_blake2b_update(blake2b_state* S, const void* in, size_t inlen) {
+	return blake2b_update(S, in, inlen, 12);
+}
+
 int hashx_blake2b_final(blake2b_state* S, void* out, size_t outlen) {
 	uint8_t buffer[BLAKE2B_OUTBYTES] = { 0 };
 	unsigned int i;
@@ -465,3 +510,105 @@ void hashx_blake2b_4r(const blake2b_param* params, const void* in,
 	/* Output hash */
 	memcpy(out, state.h, sizeof(state.h));
 }
+
+void hashx_blake2b_4r_many(const blake2b_param* params, const void* const in[],
+	const size_t inlen[], uint64_t out[][8], size_t count) {
+	size_t i = 0;
+#ifdef HASHX_SIMD_X86
+	unsigned features = hashx_cpu_features();
+	if (features & HASHX_CPU_AVX512) {
+		for (; i + 8 <= count; i += 8) {
+			hashx_blake2b_4r_x8_avx512(params, &in[i], &inlen[i], &out[i]);
+		}
+	}
+	if (features & HASHX_CPU_AVX2) {
+		for (; i + 4 <= count; i += 4) {
+			hashx_blake2b_4r_x4_avx2(params, &in[i], &inlen[i], &out[i]);
+		}
+	}
+#endif
+	for (; i < count; ++i) {
+		hashx_blake2b_4r(params, in[i], inlen[i], out[i]);
+	}
+}
+
+/* Incremental version of hashx_blake2b_4r for a state initialized by
+   hashx_blake2b_init_param. Only the partial blocks at the boundaries of
+   the inputs are copied to the state. */
+void hashx_blake2b_4r_update(blake2b_state* S, const void* in, size_t inlen) {
+	blake2b_update(S, in, inlen, 4);
+}
+
+void hashx_blake2b_4r_final(blake2b_state* S, void* out) {
+	blake2b_increment_counter(S, S->buflen);
+	blake2b_set_lastblock(S);
+	memset(&S->buf[S->buflen], 0, BLAKE2B_BLOCKBYTES - S->buflen);
+	blake2b_compress_4r(S, S->buf);
+	memcpy(out, S->h, sizeof(S->h));
+}
+
+/* Copies the next size bytes of a fragmented input to dst. */
+static void iov_gather(uint8_t* dst, size_t size, const hashx_iovec** iov,
+	const uint8_t** pin, size_t* avail) {
+	while (size > 0) {
+		while (*avail == 0) {
+			++*iov;
+			*pin = (const uint8_t*)(*iov)->base;
+			*avail = (*iov)->size;
+		}
+		size_t chunk = size < *avail ? size : *avail;
+		memcpy(dst, *pin, chunk);
+		dst += chunk;
+		size -= chunk;
+		*pin += chunk;
+		*avail -= chunk;
+	}
+}
+
+/* hashx_blake2b_4r of the concatenated fragments. Blocks that are
+   contained in a fragment are compressed in place. */
+void hashx_blake2b_4r_iov(const blake2b_param* params, const hashx_iovec iov[],
+	size_t count, void* out) {
+	blake2b_state state;
+	hashx_blake2b_init_param(&state, params);
+
+	size_t inlen = 0;
+	for (size_t i = 0; i < count; ++i) {
+		inlen += iov[i].size;
+	}
+	if (count == 0) {
+		static const hashx_iovec empty = { NULL, 0 };
+		iov = &empty;
+	}
+	const uint8_t* pin = (const uint8_t*)iov->base;
+	size_t avail = iov->size;
+
+	while (inlen > BLAKE2B_BLOCKBYTES) {
+		const uint8_t* block = state.buf;
+		while (avail == 0) {
+			++iov;
+			pin = (const uint8_t*)iov->base;
+			avail = iov->size;
+		}
+		if (avail >= BLAKE2B_BLOCKBYTES) {
+			block = pin;
+			pin += BLAKE2B_BLOCKBYTES;
+			avail -= BLAKE2B_BLOCKBYTES;
+		}
+		else {
+			iov_gather(state.buf, BLAKE2B_BLOCKBYTES, &iov, &pin, &avail);
+		}
+		blake2b_increment_counter(&state, BLAKE2B_BLOCKBYTES);
+		blake2b_compress_4r(&state, block);
+		inlen -= BLAKE2B_BLOCKBYTES;
+	}
+
+	iov_gather(state.buf, inlen, &iov, &pin, &avail);
+	memset(&state.buf[inlen], 0, BLAKE2B_BLOCKBYTES - inlen);
+	blake2b_increment_counter(&state, inlen);
+	blake2b_set_lastblock(&state);
+	blake2b_compress_4r(&state, state.buf);
+
+	/* Output hash */
+	memcpy(out, state.h, sizeof(state.h));
+}
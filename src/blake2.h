@@ -65,6 +65,21 @@ HASHX_PRIVATE int hashx_blake2b_init_param(blake2b_state* S, const blake2b_param
 HASHX_PRIVATE int hashx_blake2b_update(blake2b_state* S, const void* in, size_t inlen);
 HASHX_PRIVATE int hashx_blake2b_final(blake2b_state* S, void* out, size_t outlen);
 HASHX_PRIVATE void hashx_blake2b_4r(const blake2b_param* P, const void* in, size_t inlen, void* out);
+HASHX_PRIVATE void hashx_blake2b_4r_update(blake2b_state* S, const void* in, size_t inlen);
+HASHX_PRIVATE void hashx_blake2b_4r_final(blake2b_state* S, void* out);
+/* hashx_blake2b_4r of the concatenation of count fragments */
+HASHX_PRIVATE void hashx_blake2b_4r_iov(const blake2b_param* P, const hashx_iovec iov[], size_t count, void* out);
+
+/* Compression function with 4 or 12 rounds (SSE4.1, AVX2) */
+HASHX_PRIVATE void hashx_blake2b_compress_sse41(blake2b_state* S, const uint8_t* block, int rounds);
+HASHX_PRIVATE void hashx_blake2b_compress_avx2(blake2b_state* S, const uint8_t* block, int rounds);
+
+/* hashx_blake2b_4r for count messages of any lengths. The digest of
+   message i is stored in out[i]. */
+HASHX_PRIVATE void hashx_blake2b_4r_many(const blake2b_param* P, const void* const in[], const size_t inlen[], uint64_t out[][8], size_t count);
+/* hashx_blake2b_4r for 4 (AVX2) or 8 (AVX-512) messages in parallel */
+HASHX_PRIVATE void hashx_blake2b_4r_x4_avx2(const blake2b_param* P, const void* const in[4], const size_t inlen[4], uint64_t out[][8]);
+HASHX_PRIVATE void hashx_blake2b_4r_x8_avx512(const blake2b_param* P, const void* const in[8], const size_t inlen[8], uint64_t out[][8]);
 
 #if defined(__cplusplus)
 }
@@ -0,0 +1,228 @@
+/* Copyright (c) 2020 tevador <tevador@gmail.com> */
+/* See LICENSE for licensing information */
+
+/* BLAKE2b compression using AVX2. Each row of the 4x4 state matrix is
+   held in one vector, so the four G functions of a column or diagonal
+   step run in parallel. The multi-buffer BLAKE2b-4r hashes 4 messages
+   at once instead. */
+
+#include <string.h>
+
+#include "blake2.h"
+#include "blake2_impl.h"
+#include "force_inline.h"
+
+#if defined(HASHX_SIMD_X86) && defined(__AVX2__)
+
+#include <immintrin.h>
+
+static FORCE_INLINE __m256i rotr32(__m256i x) {
+	return _mm256_shuffle_epi32(x, _MM_SHUFFLE(2, 3, 0, 1));
+}
+
+static FORCE_INLINE __m256i rotr24(__m256i x) {
+	const __m256i shuffle = _mm256_setr_epi8(
+		3, 4, 5, 6, 7, 0, 1, 2, 11, 12, 13, 14, 15, 8, 9, 10,
+		3, 4, 5, 6, 7, 0, 1, 2, 11, 12, 13, 14, 15, 8, 9, 10);
+	return _mm256_shuffle_epi8(x, shuffle);
+}
+
+static FORCE_INLINE __m256i rotr16(__m256i x) {
+	const __m256i shuffle = _mm256_setr_epi8(
+		2, 3, 4, 5, 6, 7, 0, 1, 10, 11, 12, 13, 14, 15, 8, 9,
+		2, 3, 4, 5, 6, 7, 0, 1, 10, 11, 12, 13, 14, 15, 8, 9);
+	return _mm256_shuffle_epi8(x, shuffle);
+}
+
+static FORCE_INLINE __m256i rotr63(__m256i x) {
+	return _mm256_or_si256(_mm256_srli_epi64(x, 63), _mm256_add_epi64(x, x));
+}
+
+#define LOAD_MSG(r, i0, i1, i2, i3)                                         \
+	_mm256_set_epi64x(m[blake2b_sigma[r][i3]], m[blake2b_sigma[r][i2]],     \
+		m[blake2b_sigma[r][i1]], m[blake2b_sigma[r][i0]])
+
+#define G1(a, b, c, d, msg)                                                 \
+	do {                                                                    \
+		a = _mm256_add_epi64(_mm256_add_epi64(a, msg), b);                  \
+		d = rotr32(_mm256_xor_si256(d, a));                                 \
+		c = _mm256_add_epi64(c, d);                                         \
+		b = rotr24(_mm256_xor_si256(b, c));                                 \
+	} while (0)
+
+#define G2(a, b, c, d, msg)                                                 \
+	do {                                                                    \
+		a = _mm256_add_epi64(_mm256_add_epi64(a, msg), b);                  \
+		d = rotr16(_mm256_xor_si256(d, a));                                 \
+		c = _mm256_add_epi64(c, d);                                         \
+		b = rotr63(_mm256_xor_si256(b, c));                                 \
+	} while (0)
+
+/* Rotates rows 1, 3 and 4 so that the diagonals become columns. Row 2
+   is the last one computed by G2, so leaving it in place keeps the lane
+   permutations off the critical path. Lane j then holds diagonal j-1. */
+#define DIAGONALIZE(a, c, d)                                                \
+	do {                                                                    \
+		a = _mm256_permute4x64_epi64(a, _MM_SHUFFLE(2, 1, 0, 3));           \
+		c = _mm256_permute4x64_epi64(c, _MM_SHUFFLE(0, 3, 2, 1));           \
+		d = _mm256_permute4x64_epi64(d, _MM_SHUFFLE(1, 0, 3, 2));           \
+	} while (0)
+
+#define UNDIAGONALIZE(a, c, d)                                              \
+	do {                                                                    \
+		a = _mm256_permute4x64_epi64(a, _MM_SHUFFLE(0, 3, 2, 1));           \
+		c = _mm256_permute4x64_epi64(c, _MM_SHUFFLE(2, 1, 0, 3));           \
+		d = _mm256_permute4x64_epi64(d, _MM_SHUFFLE(1, 0, 3, 2));           \
+	} while (0)
+
+#define ROUND(r)                                                            \
+	do {                                                                    \
+		G1(a, b, c, d, LOAD_MSG(r, 0, 2, 4, 6));                            \
+		G2(a, b, c, d, LOAD_MSG(r, 1, 3, 5, 7));                            \
+		DIAGONALIZE(a, c, d);                                               \
+		G1(a, b, c, d, LOAD_MSG(r, 14, 8, 10, 12));                         \
+		G2(a, b, c, d, LOAD_MSG(r, 15, 9, 11, 13));                         \
+		UNDIAGONALIZE(a, c, d);                                             \
+	} while (0)
+
+void hashx_blake2b_compress_avx2(blake2b_state* S, const uint8_t* block,
+	int rounds) {
+	/* x86 is little endian */
+	uint64_t m[16];
+	memcpy(m, block, sizeof(m));
+
+	__m256i h0 = _mm256_loadu_si256((const __m256i*)&S->h[0]);
+	__m256i h1 = _mm256_loadu_si256((const __m256i*)&S->h[4]);
+	__m256i a = h0;
+	__m256i b = h1;
+	__m256i c = _mm256_loadu_si256((const __m256i*)&blake2b_IV[0]);
+	__m256i d = _mm256_xor_si256(
+		_mm256_loadu_si256((const __m256i*)&blake2b_IV[4]),
+		_mm256_set_epi64x(S->f[1], S->f[0], S->t[1], S->t[0]));
+
+	ROUND(0);
+	ROUND(1);
+	ROUND(2);
+	ROUND(3);
+	if (rounds > 4) {
+		ROUND(4);
+		ROUND(5);
+		ROUND(6);
+		ROUND(7);
+		ROUND(8);
+		ROUND(9);
+		ROUND(10);
+		ROUND(11);
+	}
+
+	h0 = _mm256_xor_si256(h0, _mm256_xor_si256(a, c));
+	h1 = _mm256_xor_si256(h1, _mm256_xor_si256(b, d));
+	_mm256_storeu_si256((__m256i*)&S->h[0], h0);
+	_mm256_storeu_si256((__m256i*)&S->h[4], h1);
+}
+
+/* 4x4 transpose of 64-bit words */
+static FORCE_INLINE void transpose4(__m256i* a, __m256i* b, __m256i* c,
+	__m256i* d) {
+	__m256i lo01 = _mm256_unpacklo_epi64(*a, *b);
+	__m256i hi01 = _mm256_unpackhi_epi64(*a, *b);
+	__m256i lo23 = _mm256_unpacklo_epi64(*c, *d);
+	__m256i hi23 = _mm256_unpackhi_epi64(*c, *d);
+	*a = _mm256_permute2x128_si256(lo01, lo23, 0x20);
+	*b = _mm256_permute2x128_si256(hi01, hi23, 0x20);
+	*c = _mm256_permute2x128_si256(lo01, lo23, 0x31);
+	*d = _mm256_permute2x128_si256(hi01, hi23, 0x31);
+}
+
+/* In the multi-buffer version, v[i] holds word i of the states of all
+   lanes, so the G functions need no permutations. */
+#define MSG(r, i) m[blake2b_sigma[r][i]]
+
+#define G4(r, i, a, b, c, d)                                                \
+	do {                                                                    \
+		a = _mm256_add_epi64(_mm256_add_epi64(a, MSG(r, i)), b);            \
+		d = rotr32(_mm256_xor_si256(d, a));                                 \
+		c = _mm256_add_epi64(c, d);                                         \
+		b = rotr24(_mm256_xor_si256(b, c));                                 \
+		a = _mm256_add_epi64(_mm256_add_epi64(a, MSG(r, i + 1)), b);        \
+		d = rotr16(_mm256_xor_si256(d, a));                                 \
+		c = _mm256_add_epi64(c, d);                                         \
+		b = rotr63(_mm256_xor_si256(b, c));                                 \
+	} while (0)
+
+#define ROUND4(r)                                                           \
+	do {                                                                    \
+		G4(r, 0, v[0], v[4], v[8], v[12]);                                  \
+		G4(r, 2, v[1], v[5], v[9], v[13]);                                  \
+		G4(r, 4, v[2], v[6], v[10], v[14]);                                 \
+		G4(r, 6, v[3], v[7], v[11], v[15]);                                 \
+		G4(r, 8, v[0], v[5], v[10], v[15]);                                 \
+		G4(r, 10, v[1], v[6], v[11], v[12]);                                \
+		G4(r, 12, v[2], v[7], v[8], v[13]);                                 \
+		G4(r, 14, v[3], v[4], v[9], v[14]);                                 \
+	} while (0)
+
+void hashx_blake2b_4r_x4_avx2(const blake2b_param* params,
+	const void* const in[4], const size_t inlen[4], uint64_t out[][8]) {
+	const uint8_t* p = (const uint8_t*)params;
+	uint8_t last[4][BLAKE2B_BLOCKBYTES];
+	size_t blocks[4];
+	size_t max_blocks = 0;
+	for (int lane = 0; lane < 4; ++lane) {
+		blocks[lane] = blake2b_lane_init((const uint8_t*)in[lane],
+			inlen[lane], last[lane]);
+		max_blocks = blocks[lane] > max_blocks ? blocks[lane] : max_blocks;
+	}
+
+	__m256i h[8];
+	for (int i = 0; i < 8; ++i) {
+		uint64_t param;
+		memcpy(&param, &p[8 * i], sizeof(param));
+		h[i] = _mm256_set1_epi64x(blake2b_IV[i] ^ param);
+	}
+
+	for (size_t j = 0; j < max_blocks; ++j) {
+		const uint8_t* block[4];
+		uint64_t t[4], f[4], active[4];
+		for (int lane = 0; lane < 4; ++lane) {
+			active[lane] = blake2b_lane_block((const uint8_t*)in[lane],
+				inlen[lane], blocks[lane], last[lane], j, &block[lane],
+				&t[lane], &f[lane]);
+		}
+		__m256i m[16];
+		for (int k = 0; k < 16; k += 4) {
+			m[k + 0] = _mm256_loadu_si256((const __m256i*)(block[0] + 8 * k));
+			m[k + 1] = _mm256_loadu_si256((const __m256i*)(block[1] + 8 * k));
+			m[k + 2] = _mm256_loadu_si256((const __m256i*)(block[2] + 8 * k));
+			m[k + 3] = _mm256_loadu_si256((const __m256i*)(block[3] + 8 * k));
+			transpose4(&m[k + 0], &m[k + 1], &m[k + 2], &m[k + 3]);
+		}
+		__m256i v[16];
+		for (int i = 0; i < 8; ++i) {
+			v[i] = h[i];
+			v[i + 8] = _mm256_set1_epi64x(blake2b_IV[i]);
+		}
+		v[12] = _mm256_xor_si256(v[12], _mm256_loadu_si256((const __m256i*)t));
+		v[14] = _mm256_xor_si256(v[14], _mm256_loadu_si256((const __m256i*)f));
+
+		ROUND4(0);
+		ROUND4(1);
+		ROUND4(2);
+		ROUND4(3);
+
+		__m256i mask = _mm256_loadu_si256((const __m256i*)active);
+		for (int i = 0; i < 8; ++i) {
+			__m256i x = _mm256_xor_si256(h[i], _mm256_xor_si256(v[i], v[i + 8]));
+			h[i] = _mm256_blendv_epi8(h[i], x, mask);
+		}
+	}
+
+	transpose4(&h[0], &h[1], &h[2], &h[3]);
+	transpose4(&h[4], &h[5], &h[6], &h[7]);
+	for (int lane = 0; lane < 4; ++lane) {
+		_mm256_storeu_si256((__m256i*)&out[lane][0], h[lane]);
+		_mm256_storeu_si256((__m256i*)&out[lane][4], h[lane + 4]);
+	}
+}
+
+#endif
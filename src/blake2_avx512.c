@@ -0,0 +1,129 @@
+/* Copyright (c) 2020 tevador <tevador@gmail.com> */
+/* See LICENSE for licensing information */
+
+/* Multi-buffer BLAKE2b-4r for 8 messages in parallel using AVX-512F. */
+
+#include <string.h>
+
+#include "blake2.h"
+#include "blake2_impl.h"
+#include "force_inline.h"
+
+#if defined(HASHX_SIMD_X86) && defined(__AVX512F__)
+
+#include <immintrin.h>
+
+/* 8x8 transpose of 64-bit words */
+static FORCE_INLINE void transpose8(__m512i r[8]) {
+	__m512i t[8], u[8];
+	for (int i = 0; i < 8; i += 2) {
+		t[i + 0] = _mm512_unpacklo_epi64(r[i], r[i + 1]);
+		t[i + 1] = _mm512_unpackhi_epi64(r[i], r[i + 1]);
+	}
+	/* t[0] = r0[0] r1[0] r0[2] r1[2] r0[4] r1[4] r0[6] r1[6] */
+	for (int i = 0; i < 8; i += 4) {
+		u[i + 0] = _mm512_shuffle_i64x2(t[i + 0], t[i + 2], 0x88);
+		u[i + 1] = _mm512_shuffle_i64x2(t[i + 0], t[i + 2], 0xdd);
+		u[i + 2] = _mm512_shuffle_i64x2(t[i + 1], t[i + 3], 0x88);
+		u[i + 3] = _mm512_shuffle_i64x2(t[i + 1], t[i + 3], 0xdd);
+	}
+	/* u[0] = r0[0] r1[0] r0[4] r1[4] r2[0] r3[0] r2[4] r3[4] */
+	r[0] = _mm512_shuffle_i64x2(u[0], u[4], 0x88);
+	r[4] = _mm512_shuffle_i64x2(u[0], u[4], 0xdd);
+	r[2] = _mm512_shuffle_i64x2(u[1], u[5], 0x88);
+	r[6] = _mm512_shuffle_i64x2(u[1], u[5], 0xdd);
+	r[1] = _mm512_shuffle_i64x2(u[2], u[6], 0x88);
+	r[5] = _mm512_shuffle_i64x2(u[2], u[6], 0xdd);
+	r[3] = _mm512_shuffle_i64x2(u[3], u[7], 0x88);
+	r[7] = _mm512_shuffle_i64x2(u[3], u[7], 0xdd);
+}
+
+#define MSG(r, i) m[blake2b_sigma[r][i]]
+
+/* v[i] holds word i of the states of all lanes */
+#define G8(r, i, a, b, c, d)                                                \
+	do {                                                                    \
+		a = _mm512_add_epi64(_mm512_add_epi64(a, MSG(r, i)), b);            \
+		d = _mm512_ror_epi64(_mm512_xor_si512(d, a), 32);                   \
+		c = _mm512_add_epi64(c, d);                                         \
+		b = _mm512_ror_epi64(_mm512_xor_si512(b, c), 24);                   \
+		a = _mm512_add_epi64(_mm512_add_epi64(a, MSG(r, i + 1)), b);        \
+		d = _mm512_ror_epi64(_mm512_xor_si512(d, a), 16);                   \
+		c = _mm512_add_epi64(c, d);                                         \
+		b = _mm512_ror_epi64(_mm512_xor_si512(b, c), 63);                   \
+	} while (0)
+
+#define ROUND8(r)                                                           \
+	do {                                                                    \
+		G8(r, 0, v[0], v[4], v[8], v[12]);                                  \
+		G8(r, 2, v[1], v[5], v[9], v[13]);                                  \
+		G8(r, 4, v[2], v[6], v[10], v[14]);                                 \
+		G8(r, 6, v[3], v[7], v[11], v[15]);                                 \
+		G8(r, 8, v[0], v[5], v[10], v[15]);                                 \
+		G8(r, 10, v[1], v[6], v[11], v[12]);                                \
+		G8(r, 12, v[2], v[7], v[8], v[13]);                                 \
+		G8(r, 14, v[3], v[4], v[9], v[14]);                                 \
+	} while (0)
+
+void hashx_blake2b_4r_x8_avx512(const blake2b_param* params,
+	const void* const in[8], const size_t inlen[8], uint64_t out[][8]) {
+	const uint8_t* p = (const uint8_t*)params;
+	uint8_t last[8][BLAKE2B_BLOCKBYTES];
+	size_t blocks[8];
+	size_t max_blocks = 0;
+	for (int lane = 0; lane < 8; ++lane) {
+		blocks[lane] = blake2b_lane_init((const uint8_t*)in[lane],
+			inlen[lane], last[lane]);
+		max_blocks = blocks[lane] > max_blocks ? blocks[lane] : max_blocks;
+	}
+
+	__m512i h[8];
+	for (int i = 0; i < 8; ++i) {
+		uint64_t param;
+		memcpy(&param, &p[8 * i], sizeof(param));
+		h[i] = _mm512_set1_epi64(blake2b_IV[i] ^ param);
+	}
+
+	for (size_t j = 0; j < max_blocks; ++j) {
+		const uint8_t* block[8];
+		uint64_t t[8], f[8];
+		__mmask8 active = 0;
+		for (int lane = 0; lane < 8; ++lane) {
+			uint64_t mask = blake2b_lane_block((const uint8_t*)in[lane],
+				inlen[lane], blocks[lane], last[lane], j, &block[lane],
+				&t[lane], &f[lane]);
+			active |= (__mmask8)((mask & 1) << lane);
+		}
+		__m512i m[16];
+		for (int k = 0; k < 16; k += 8) {
+			for (int lane = 0; lane < 8; ++lane) {
+				m[k + lane] = _mm512_loadu_si512(block[lane] + 8 * k);
+			}
+			transpose8(&m[k]);
+		}
+		__m512i v[16];
+		for (int i = 0; i < 8; ++i) {
+			v[i] = h[i];
+			v[i + 8] = _mm512_set1_epi64(blake2b_IV[i]);
+		}
+		v[12] = _mm512_xor_si512(v[12], _mm512_loadu_si512(t));
+		v[14] = _mm512_xor_si512(v[14], _mm512_loadu_si512(f));
+
+		ROUND8(0);
+		ROUND8(1);
+		ROUND8(2);
+		ROUND8(3);
+
+		for (int i = 0; i < 8; ++i) {
+			__m512i x = _mm512_ternarylogic_epi64(h[i], v[i], v[i + 8], 0x96);
+			h[i] = _mm512_mask_mov_epi64(h[i], active, x);
+		}
+	}
+
+	transpose8(h);
+	for (int lane = 0; lane < 8; ++lane) {
+		_mm512_storeu_si512(out[lane], h[lane]);
+	}
+}
+
+#endif
@@ -0,0 +1,76 @@
+/* Copyright (c) 2020 tevador <tevador@gmail.com> */
+/* See LICENSE for licensing information */
+
+/* Constants shared by the BLAKE2b implementations. */
+
+#ifndef BLAKE2_IMPL_H
+#define BLAKE2_IMPL_H
+
+#include <stdint.h>
+#include <string.h>
+
+#include "blake2.h"
+#include "force_inline.h"
+
+static const uint64_t blake2b_IV[8] = {
+	UINT64_C(0x6a09e667f3bcc908), UINT64_C(0xbb67ae8584caa73b),
+	UINT64_C(0x3c6ef372fe94f82b), UINT64_C(0xa54ff53a5f1d36f1),
+	UINT64_C(0x510e527fade682d1), UINT64_C(0x9b05688c2b3e6c1f),
+	UINT64_C(0x1f83d9abfb41bd6b), UINT64_C(0x5be0cd19137e2179) };
+
+/* Message schedule. The scalar code uses the equivalent BLAKE2_SIGMA
+   macros. With constant indices, the compiler resolves the table at
+   compile time. */
+static const uint8_t blake2b_sigma[12][16] = {
+	{ 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 },
+	{ 14, 10, 4, 8, 9, 15, 13, 6, 1, 12, 0, 2, 11, 7, 5, 3 },
+	{ 11, 8, 12, 0, 5, 2, 15, 13, 10, 14, 3, 6, 7, 1, 9, 4 },
+	{ 7, 9, 3, 1, 13, 12, 11, 14, 2, 6, 5, 10, 4, 0, 15, 8 },
+	{ 9, 0, 5, 7, 2, 4, 10, 15, 14, 1, 11, 12, 6, 8, 3, 13 },
+	{ 2, 12, 6, 10, 0, 11, 8, 3, 4, 13, 7, 5, 15, 14, 1, 9 },
+	{ 12, 5, 1, 15, 14, 13, 4, 10, 0, 7, 6, 3, 9, 2, 8, 11 },
+	{ 13, 11, 7, 14, 12, 1, 3, 9, 5, 0, 15, 4, 8, 6, 2, 10 },
+	{ 6, 15, 14, 9, 11, 3, 0, 8, 12, 2, 13, 7, 1, 4, 10, 5 },
+	{ 10, 2, 8, 4, 7, 6, 1, 5, 15, 11, 9, 14, 3, 12, 13, 0 },
+	{ 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 },
+	{ 14, 10, 4, 8, 9, 15, 13, 6, 1, 12, 0, 2, 11, 7, 5, 3 },
+};
+
+/*
+ * Helpers for the multi-buffer BLAKE2b-4r, which hashes one message per
+ * vector lane. Messages can have different lengths, so each lane follows
+ * the block sequence of hashx_blake2b_4r: full blocks while more than one
+ * block remains, then the zero padded last block with the final flag.
+ */
+
+/* Copies the last block of a message to a zero padded buffer and returns
+   the number of blocks of the message. */
+static FORCE_INLINE size_t blake2b_lane_init(const uint8_t* in, size_t inlen,
+	uint8_t last[BLAKE2B_BLOCKBYTES]) {
+	size_t blocks = inlen == 0 ? 1 :
+		(inlen + BLAKE2B_BLOCKBYTES - 1) / BLAKE2B_BLOCKBYTES;
+	size_t offset = (blocks - 1) * BLAKE2B_BLOCKBYTES;
+	memset(last, 0, BLAKE2B_BLOCKBYTES);
+	memcpy(last, in + offset, inlen - offset);
+	return blocks;
+}
+
+/* Selects block j of a message and its counter and final flag. Returns
+   the lane mask: all ones if the block exists, zero if the message has
+   already been hashed and the result of the lane must be discarded. */
+static FORCE_INLINE uint64_t blake2b_lane_block(const uint8_t* in,
+	size_t inlen, size_t blocks, const uint8_t* last, size_t j,
+	const uint8_t** block, uint64_t* t, uint64_t* f) {
+	if (j + 1 < blocks) {
+		*block = in + j * BLAKE2B_BLOCKBYTES;
+		*t = (j + 1) * BLAKE2B_BLOCKBYTES;
+		*f = 0;
+		return ~UINT64_C(0);
+	}
+	*block = last;
+	*t = inlen;
+	*f = ~UINT64_C(0);
+	return j + 1 == blocks ? ~UINT64_C(0) : 0;
+}
+
+#endif
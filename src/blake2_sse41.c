@@ -0,0 +1,150 @@
+/* Copyright (c) 2020 tevador <tevador@gmail.com> */
+/* See LICENSE for licensing information */
+
+/* BLAKE2b compression using SSE4.1. Each row of the 4x4 state matrix is
+   held in two vectors, so two G functions run in parallel. */
+
+#include <string.h>
+
+#include "blake2.h"
+#include "blake2_impl.h"
+#include "force_inline.h"
+
+/* MSVC has no switch for SSE4.1, its intrinsics are always available */
+#if defined(HASHX_SIMD_X86) && (defined(__SSE4_1__) || defined(_MSC_VER))
+
+#include <smmintrin.h>
+
+static FORCE_INLINE __m128i rotr32(__m128i x) {
+	return _mm_shuffle_epi32(x, _MM_SHUFFLE(2, 3, 0, 1));
+}
+
+static FORCE_INLINE __m128i rotr24(__m128i x) {
+	const __m128i shuffle = _mm_setr_epi8(
+		3, 4, 5, 6, 7, 0, 1, 2, 11, 12, 13, 14, 15, 8, 9, 10);
+	return _mm_shuffle_epi8(x, shuffle);
+}
+
+static FORCE_INLINE __m128i rotr16(__m128i x) {
+	const __m128i shuffle = _mm_setr_epi8(
+		2, 3, 4, 5, 6, 7, 0, 1, 10, 11, 12, 13, 14, 15, 8, 9);
+	return _mm_shuffle_epi8(x, shuffle);
+}
+
+static FORCE_INLINE __m128i rotr63(__m128i x) {
+	return _mm_or_si128(_mm_srli_epi64(x, 63), _mm_add_epi64(x, x));
+}
+
+#define LOAD_MSG(r, i0, i1)                                                 \
+	_mm_set_epi64x(m[blake2b_sigma[r][i1]], m[blake2b_sigma[r][i0]])
+
+#define G1(al, ah, bl, bh, cl, ch, dl, dh, ml, mh)                          \
+	do {                                                                    \
+		al = _mm_add_epi64(_mm_add_epi64(al, ml), bl);                      \
+		ah = _mm_add_epi64(_mm_add_epi64(ah, mh), bh);                      \
+		dl = rotr32(_mm_xor_si128(dl, al));                                 \
+		dh = rotr32(_mm_xor_si128(dh, ah));                                 \
+		cl = _mm_add_epi64(cl, dl);                                         \
+		ch = _mm_add_epi64(ch, dh);                                         \
+		bl = rotr24(_mm_xor_si128(bl, cl));                                 \
+		bh = rotr24(_mm_xor_si128(bh, ch));                                 \
+	} while (0)
+
+#define G2(al, ah, bl, bh, cl, ch, dl, dh, ml, mh)                          \
+	do {                                                                    \
+		al = _mm_add_epi64(_mm_add_epi64(al, ml), bl);                      \
+		ah = _mm_add_epi64(_mm_add_epi64(ah, mh), bh);                      \
+		dl = rotr16(_mm_xor_si128(dl, al));                                 \
+		dh = rotr16(_mm_xor_si128(dh, ah));                                 \
+		cl = _mm_add_epi64(cl, dl);                                         \
+		ch = _mm_add_epi64(ch, dh);                                         \
+		bl = rotr63(_mm_xor_si128(bl, cl));                                 \
+		bh = rotr63(_mm_xor_si128(bh, ch));                                 \
+	} while (0)
+
+/* Rotates rows 1, 3 and 4 so that the diagonals become columns. Row 2
+   is the last one computed by G2, so it stays in place. Lane j then
+   holds diagonal j-1. */
+#define DIAGONALIZE()                                                       \
+	do {                                                                    \
+		__m128i t0 = _mm_alignr_epi8(al, ah, 8);                            \
+		__m128i t1 = _mm_alignr_epi8(ah, al, 8);                            \
+		al = t0; ah = t1;                                                   \
+		t0 = _mm_alignr_epi8(ch, cl, 8);                                    \
+		t1 = _mm_alignr_epi8(cl, ch, 8);                                    \
+		cl = t0; ch = t1;                                                   \
+		t0 = dl; dl = dh; dh = t0;                                          \
+	} while (0)
+
+#define UNDIAGONALIZE()                                                     \
+	do {                                                                    \
+		__m128i t0 = _mm_alignr_epi8(ah, al, 8);                            \
+		__m128i t1 = _mm_alignr_epi8(al, ah, 8);                            \
+		al = t0; ah = t1;                                                   \
+		t0 = _mm_alignr_epi8(cl, ch, 8);                                    \
+		t1 = _mm_alignr_epi8(ch, cl, 8);                                    \
+		cl = t0; ch = t1;                                                   \
+		t0 = dl; dl = dh; dh = t0;                                          \
+	} while (0)
+
+#define ROUND(r)                                                            \
+	do {                                                                    \
+		G1(al, ah, bl, bh, cl, ch, dl, dh,                                  \
+			LOAD_MSG(r, 0, 2), LOAD_MSG(r, 4, 6));                          \
+		G2(al, ah, bl, bh, cl, ch, dl, dh,                                  \
+			LOAD_MSG(r, 1, 3), LOAD_MSG(r, 5, 7));                          \
+		DIAGONALIZE();                                                      \
+		G1(al, ah, bl, bh, cl, ch, dl, dh,                                  \
+			LOAD_MSG(r, 14, 8), LOAD_MSG(r, 10, 12));                       \
+		G2(al, ah, bl, bh, cl, ch, dl, dh,                                  \
+			LOAD_MSG(r, 15, 9), LOAD_MSG(r, 11, 13));                       \
+		UNDIAGONALIZE();                                                    \
+	} while (0)
+
+void hashx_blake2b_compress_sse41(blake2b_state* S, const uint8_t* block,
+	int rounds) {
+	/* x86 is little endian */
+	uint64_t m[16];
+	memcpy(m, block, sizeof(m));
+
+	__m128i al = _mm_loadu_si128((const __m128i*)&S->h[0]);
+	__m128i ah = _mm_loadu_si128((const __m128i*)&S->h[2]);
+	__m128i bl = _mm_loadu_si128((const __m128i*)&S->h[4]);
+	__m128i bh = _mm_loadu_si128((const __m128i*)&S->h[6]);
+	__m128i cl = _mm_loadu_si128((const __m128i*)&blake2b_IV[0]);
+	__m128i ch = _mm_loadu_si128((const __m128i*)&blake2b_IV[2]);
+	__m128i dl = _mm_xor_si128(_mm_loadu_si128((const __m128i*)&blake2b_IV[4]),
+		_mm_set_epi64x(S->t[1], S->t[0]));
+	__m128i dh = _mm_xor_si128(_mm_loadu_si128((const __m128i*)&blake2b_IV[6]),
+		_mm_set_epi64x(S->f[1], S->f[0]));
+
+	ROUND(0);
+	ROUND(1);
+	ROUND(2);
+	ROUND(3);
+	if (rounds > 4) {
+		ROUND(4);
+		ROUND(5);
+		ROUND(6);
+		ROUND(7);
+		ROUND(8);
+		ROUND(9);
+		ROUND(10);
+		ROUND(11);
+	}
+
+	al = _mm_xor_si128(al, cl);
+	ah = _mm_xor_si128(ah, ch);
+	bl = _mm_xor_si128(bl, dl);
+	bh = _mm_xor_si128(bh, dh);
+	_mm_storeu_si128((__m128i*)&S->h[0],
+		_mm_xor_si128(_mm_loadu_si128((const __m128i*)&S->h[0]), al));
+	_mm_storeu_si128((__m128i*)&S->h[2],
+		_mm_xor_si128(_mm_loadu_si128((const __m128i*)&S->h[2]), ah));
+	_mm_storeu_si128((__m128i*)&S->h[4],
+		_mm_xor_si128(_mm_loadu_si128((const __m128i*)&S->h[4]), bl));
+	_mm_storeu_si128((__m128i*)&S->h[6],
+		_mm_xor_si128(_mm_loadu_si128((const __m128i*)&S->h[6]), bh));
+}
+
+#endif
@@ -0,0 +1,276 @@
+/* Copyright (c) 2020 tevador <tevador@gmail.com> */
+/* See LICENSE for licensing information */
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include <hashx.h>
+#include "context.h"
+#include "compiler.h"
+#include "hashx_thread.h"
+
+/* The cache is split into shards with separate locks, so lookups of
+   different seeds rarely contend. Each shard is an LRU list of its own,
+   so small caches use a single shard to keep the eviction order exact. */
+#define CACHE_MAX_SHARDS 16
+#define CACHE_MIN_SHARD_CAPACITY 16
+
+typedef struct cache_entry {
+	siphash_state keys[2];
+	hashx_ctx* ctx;
+	struct cache_shard* shard;
+	struct cache_entry* chain;
+	struct cache_entry* lru_prev;
+	struct cache_entry* lru_next;
+	/* one reference is held by the cache while the entry is in the table */
+	unsigned refs;
+} cache_entry;
+
+typedef struct cache_shard {
+	hashx_mutex lock;
+	cache_entry** buckets;
+	size_t bucket_mask;
+	/* most recently used entry */
+	cache_entry* lru_head;
+	cache_entry* lru_tail;
+	size_t size;
+	size_t capacity;
+	uint64_t hits;
+	uint64_t misses;
+} cache_shard;
+
+struct hashx_cache {
+	hashx_type type;
+	size_t num_shards;
+	cache_shard shards[CACHE_MAX_SHARDS];
+};
+
+static cache_shard* select_shard(hashx_cache* cache,
+	const siphash_state keys[2]) {
+	/* the keys are a BLAKE2b digest, so any bits are uniformly distributed */
+	return &cache->shards[keys[1].v0 % cache->num_shards];
+}
+
+static cache_entry** find_slot(cache_shard* shard, const siphash_state keys[2]) {
+	cache_entry** slot = &shard->buckets[keys[1].v1 & shard->bucket_mask];
+	while (*slot != NULL && memcmp((*slot)->keys, keys, sizeof((*slot)->keys))) {
+		slot = &(*slot)->chain;
+	}
+	return slot;
+}
+
+static void lru_unlink(cache_shard* shard, cache_entry* entry) {
+	if (entry->lru_prev != NULL) {
+		entry->lru_prev->lru_next = entry->lru_next;
+	}
+	else {
+		shard->lru_head = entry->lru_next;
+	}
+	if (entry->lru_next != NULL) {
+		entry->lru_next->lru_prev = entry->lru_prev;
+	}
+	else {
+		shard->lru_tail = entry->lru_prev;
+	}
+}
+
+static void lru_push(cache_shard* shard, cache_entry* entry) {
+	entry->lru_prev = NULL;
+	entry->lru_next = shard->lru_head;
+	if (shard->lru_head != NULL) {
+		shard->lru_head->lru_prev = entry;
+	}
+	else {
+		shard->lru_tail = entry;
+	}
+	shard->lru_head = entry;
+}
+
+static void entry_free(cache_entry* entry) {
+	hashx_free(entry->ctx);
+	free(entry);
+}
+
+/* drops a reference and returns the entry if it has to be freed */
+static cache_entry* entry_unref(cache_entry* entry) {
+	assert(entry->refs > 0);
+	return --entry->refs == 0 ? entry : NULL;
+}
+
+/* removes the least recently used entry from the table */
+static cache_entry* evict(cache_shard* shard) {
+	cache_entry* entry = shard->lru_tail;
+	*find_slot(shard, entry->keys) = entry->chain;
+	lru_unlink(shard, entry);
+	shard->size--;
+	return entry_unref(entry);
+}
+
+hashx_cache* hashx_cache_alloc(hashx_type type, size_t capacity) {
+	if (!HASHX_COMPILER && (type & HASHX_COMPILED)) {
+		return NULL;
+	}
+	hashx_cache* cache = malloc(sizeof(hashx_cache));
+	if (cache == NULL) {
+		return NULL;
+	}
+	if (capacity == 0) {
+		capacity = 1;
+	}
+	cache->type = type;
+	size_t num_shards = capacity / CACHE_MIN_SHARD_CAPACITY;
+	if (num_shards == 0) {
+		num_shards = 1;
+	}
+	if (num_shards > CACHE_MAX_SHARDS) {
+		num_shards = CACHE_MAX_SHARDS;
+	}
+	cache->num_shards = num_shards;
+	for (size_t i = 0; i < cache->num_shards; ++i) {
+		cache_shard* shard = &cache->shards[i];
+		/* the shard capacities add up to exactly 'capacity' */
+		size_t shard_capacity = capacity / num_shards +
+			(i < capacity % num_shards);
+		size_t num_buckets = 1;
+		while (num_buckets < shard_capacity) {
+			num_buckets *= 2;
+		}
+		shard->buckets = calloc(num_buckets, sizeof(cache_entry*));
+		if (shard->buckets == NULL || !hashx_mutex_init(&shard->lock)) {
+			free(shard->buckets);
+			cache->num_shards = i;
+			hashx_cache_free(cache);
+			return NULL;
+		}
+		shard->bucket_mask = num_buckets - 1;
+		shard->lru_head = NULL;
+		shard->lru_tail = NULL;
+		shard->size = 0;
+		shard->capacity = shard_capacity;
+		shard->hits = 0;
+		shard->misses = 0;
+	}
+	return cache;
+}
+
+hashx_ctx* hashx_cache_get(hashx_cache* cache, const void* seed, size_t size) {
+	assert(cache != NULL);
+	assert(seed != NULL || size == 0);
+	cache_entry* entry = malloc(sizeof(cache_entry));
+	if (entry == NULL) {
+		return NULL;
+	}
+	hashx_seed_keys(seed, size, entry->keys);
+	cache_shard* shard = select_shard(cache, entry->keys);
+	hashx_mutex_lock(&shard->lock);
+	cache_entry* found = *find_slot(shard, entry->keys);
+	if (found != NULL) {
+		shard->hits++;
+		found->refs++;
+		lru_unlink(shard, found);
+		lru_push(shard, found);
+		hashx_mutex_unlock(&shard->lock);
+		free(entry);
+		return found->ctx;
+	}
+	shard->misses++;
+	hashx_mutex_unlock(&shard->lock);
+	/* The function is created without holding the lock. If another thread
+	   inserts the same seed in the meantime, its instance is used. */
+	entry->ctx = hashx_alloc(cache->type);
+	if (entry->ctx == NULL || !hashx_make_keys(entry->ctx, entry->keys)) {
+		hashx_free(entry->ctx);
+		free(entry);
+		return NULL;
+	}
+	entry->ctx->cache_entry = entry;
+	entry->shard = shard;
+	entry->refs = 2;
+	cache_entry* evicted = NULL;
+	hashx_mutex_lock(&shard->lock);
+	cache_entry** slot = find_slot(shard, entry->keys);
+	if (*slot != NULL) {
+		found = *slot;
+		found->refs++;
+		hashx_mutex_unlock(&shard->lock);
+		entry_free(entry);
+		return found->ctx;
+	}
+	if (shard->size == shard->capacity) {
+		evicted = evict(shard);
+		slot = find_slot(shard, entry->keys);
+	}
+	entry->chain = NULL;
+	*slot = entry;
+	lru_push(shard, entry);
+	shard->size++;
+	hashx_mutex_unlock(&shard->lock);
+	if (evicted != NULL) {
+		entry_free(evicted);
+	}
+	return entry->ctx;
+}
+
+void hashx_cache_release(hashx_cache* cache, hashx_ctx* ctx) {
+	assert(cache != NULL);
+	assert(ctx != NULL && ctx->cache_entry != NULL);
+	cache_entry* entry = ctx->cache_entry;
+	cache_shard* shard = entry->shard;
+	hashx_mutex_lock(&shard->lock);
+	entry = entry_unref(entry);
+	hashx_mutex_unlock(&shard->lock);
+	if (entry != NULL) {
+		entry_free(entry);
+	}
+}
+
+void hashx_cache_stats(hashx_cache* cache, uint64_t* hits, uint64_t* misses) {
+	assert(cache != NULL);
+	uint64_t total_hits = 0, total_misses = 0;
+	for (size_t i = 0; i < cache->num_shards; ++i) {
+		cache_shard* shard = &cache->shards[i];
+		hashx_mutex_lock(&shard->lock);
+		total_hits += shard->hits;
+		total_misses += shard->misses;
+		hashx_mutex_unlock(&shard->lock);
+	}
+	if (hits != NULL) {
+		*hits = total_hits;
+	}
+	if (misses != NULL) {
+		*misses = total_misses;
+	}
+}
+
+size_t hashx_cache_size(hashx_cache* cache) {
+	assert(cache != NULL);
+	size_t size = 0;
+	for (size_t i = 0; i < cache->num_shards; ++i) {
+		cache_shard* shard = &cache->shards[i];
+		hashx_mutex_lock(&shard->lock);
+		size += shard->size;
+		hashx_mutex_unlock(&shard->lock);
+	}
+	return size;
+}
+
+void hashx_cache_free(hashx_cache* cache) {
+	if (cache == NULL) {
+		return;
+	}
+	for (size_t i = 0; i < cache->num_shards; ++i) {
+		cache_shard* shard = &cache->shards[i];
+		while (shard->lru_tail != NULL) {
+			cache_entry* entry = evict(shard);
+			/* all instances must have been released */
+			assert(entry != NULL);
+			if (entry != NULL) {
+				entry_free(entry);
+			}
+		}
+		free(shard->buckets);
+		hashx_mutex_destroy(&shard->lock);
+	}
+	free(cache);
+}
@@ -2,17 +2,89 @@
 /* See LICENSE for licensing information */
 
 #include <stdbool.h>
+#include <string.h>
 
 #include "compiler.h"
 #include "virtual_memory.h"
 #include "program.h"
 #include "context.h"
+#include "perf_map.h"
 
 bool hashx_compiler_init(hashx_ctx* ctx) {
-	ctx->code = hashx_vm_alloc(COMP_CODE_SIZE);
+	void* code_rw = NULL;
+	if (ctx->arena != NULL) {
+		ctx->code = hashx_vm_arena_take(ctx->arena);
+	}
+	else if ((ctx->code = hashx_vm_alloc_dual(COMP_CODE_SIZE, &code_rw)) == NULL) {
+		ctx->code = hashx_vm_alloc(COMP_CODE_SIZE);
+	}
+	ctx->code_rw = code_rw != NULL ? code_rw : ctx->code;
 	return ctx->code != NULL;
 }
 
+void hashx_compiler_rw(hashx_ctx* ctx) {
+	if (ctx->code_rw != ctx->code) {
+		return;
+	}
+	if (ctx->arena != NULL) {
+		hashx_vm_arena_slot_rw(ctx->arena, ctx->code);
+	}
+	else {
+		hashx_vm_rw(ctx->code, COMP_CODE_SIZE);
+	}
+}
+
+void hashx_compiler_rx(hashx_ctx* ctx) {
+	if (ctx->code_rw != ctx->code) {
+		return;
+	}
+	if (ctx->arena != NULL) {
+		hashx_vm_arena_slot_rx(ctx->arena, ctx->code);
+	}
+	else {
+		hashx_vm_rx(ctx->code, COMP_CODE_SIZE);
+	}
+}
+
+void hashx_compiler_copy(hashx_ctx* ctx, const hashx_ctx* source) {
+	hashx_compiler_rw(ctx);
+	memcpy(ctx->code_rw, source->code, source->code_length);
+	hashx_compiler_rx(ctx);
+#if defined(__GNUC__) && defined(HASHX_COMPILER_A64)
+	__builtin___clear_cache((char*)ctx->code,
+		(char*)ctx->code + source->code_length);
+#endif
+	ctx->code_length = source->code_length;
+	size_t func_size = ctx->code_length;
+#ifndef HASHX_BLOCK_MODE
+	ctx->hash = NULL;
+	if (source->hash != NULL) {
+		func_size = (const uint8_t*)source->hash - source->code;
+		ctx->hash = (hash_func*)(ctx->code + func_size);
+	}
+#endif
+	/* the program is not available, so only the functions are described */
+	if (hashx_perf_map_level()) {
+		hashx_perf_map_add(ctx->code, func_size, "hashx_program_func",
+			NULL, NULL);
+#ifndef HASHX_BLOCK_MODE
+		if (ctx->hash != NULL) {
+			hashx_perf_map_add(ctx->code + func_size,
+				ctx->code_length - func_size, "hashx_hash_func", NULL, NULL);
+		}
+#endif
+	}
+}
+
 void hashx_compiler_destroy(hashx_ctx* ctx) {
-	hashx_vm_free(ctx->code, COMP_CODE_SIZE);
+	if (ctx->arena != NULL) {
+		hashx_vm_arena_give(ctx->arena, ctx->code);
+	}
+	else if (ctx->code_rw != ctx->code) {
+		hashx_vm_free(ctx->code_rw, COMP_CODE_SIZE);
+		hashx_vm_free(ctx->code, COMP_CODE_SIZE);
+	}
+	else {
+		hashx_vm_free(ctx->code, COMP_CODE_SIZE);
+	}
 }
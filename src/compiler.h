@@ -10,9 +10,9 @@
 #include "virtual_memory.h"
 #include "program.h"
 
-HASHX_PRIVATE void hashx_compile_x86(const hashx_program* program, uint8_t* code);
+HASHX_PRIVATE void hashx_compile_x86(const hashx_program* program, hashx_ctx* ctx);
 
-HASHX_PRIVATE void hashx_compile_a64(const hashx_program* program, uint8_t* code);
+HASHX_PRIVATE void hashx_compile_a64(const hashx_program* program, hashx_ctx* ctx);
 
 #if defined(_M_X64) || defined(__x86_64__)
 #define HASHX_COMPILER 1
@@ -28,14 +28,32 @@ HASHX_PRIVATE void hashx_compile_a64(const hashx_program* program, uint8_t* code
 #endif
 
 HASHX_PRIVATE bool hashx_compiler_init(hashx_ctx* compiler);
+HASHX_PRIVATE void hashx_compiler_rw(hashx_ctx* compiler);
+HASHX_PRIVATE void hashx_compiler_rx(hashx_ctx* compiler);
 HASHX_PRIVATE void hashx_compiler_destroy(hashx_ctx* compiler);
+/* Copy compiled code from another instance. The code only uses relative
+   addresses, so it can run from any location. */
+HASHX_PRIVATE void hashx_compiler_copy(hashx_ctx* compiler, const hashx_ctx* source);
 
 #define COMP_PAGE_SIZE 4096
 #define COMP_RESERVE_SIZE 1024
 #define COMP_AVG_INSTR_SIZE 5
+#define COMP_FUNC_ALIGN 64
+#ifdef HASHX_COMPILER_A64
+/* Space for the interleaved, single-lane and branch stub copies of the
+   program. A valid program has 192 multiplications, which take at most 20
+   bytes of code each, and the other instructions take at most 52 bytes
+   (a BRANCH takes more, but its TARGET takes none). */
 #define COMP_CODE_SIZE                                                        \
 	ALIGN_SIZE(                                                               \
-		HASHX_PROGRAM_MAX_SIZE * COMP_AVG_INSTR_SIZE + COMP_RESERVE_SIZE,     \
+		192 * 20 + (HASHX_PROGRAM_MAX_SIZE - 192) * 52 + COMP_RESERVE_SIZE,    \
 	COMP_PAGE_SIZE)
+#else
+/* space for the multi-lane program function and the hash function */
+#define COMP_CODE_SIZE                                                        \
+	ALIGN_SIZE(                                                               \
+		2 * (HASHX_PROGRAM_MAX_SIZE * COMP_AVG_INSTR_SIZE + COMP_RESERVE_SIZE),\
+	COMP_PAGE_SIZE)
+#endif
 
 #endif
@@ -8,6 +8,8 @@
 #include "program.h"
 #include "virtual_memory.h"
 #include "unreachable.h"
+#include "context.h"
+#include "perf_map.h"
 
 #define EMIT(p,x) do {           \
         memcpy(p, x, sizeof(x)); \
@@ -23,132 +25,299 @@
 
 #ifdef HASHX_COMPILER_A64
 
+/* Two lanes are interleaved: lane A uses x0-x7 with branch state w9 and
+   lane B uses x19-x26 with branch state w13. A trailing odd lane runs
+   through a single-lane copy of the program. w17 counts the lanes that
+   took a branch and is returned. */
+#define A64_LANE_B 19
+
+/* a branch is taken at most once per lane, so each program has at most
+   one branch per TARGET instruction */
+#define A64_MAX_BRANCHES (HASHX_PROGRAM_MAX_SIZE / 2)
+
+/* a branch of the interleaved code */
+typedef struct a64_branch {
+	uint8_t* site;   /* "cbnz w15, stub A; b.eq stub B" */
+	uint8_t* target; /* interleaved code of the block */
+	int first;       /* first instruction of the block */
+	int last;        /* the BRANCH instruction */
+} a64_branch;
+
 static const uint8_t a64_prologue[] = {
-	0x07, 0x1c, 0x40, 0xf9, /* ldr x7, [x0, #56] */
-	0x06, 0x18, 0x40, 0xf9, /* ldr x6, [x0, #48] */
-	0x05, 0x14, 0x40, 0xf9, /* ldr x5, [x0, #40] */
-	0x04, 0x10, 0x40, 0xf9, /* ldr x4, [x0, #32] */
-	0x03, 0x0c, 0x40, 0xf9, /* ldr x3, [x0, #24] */
-	0x02, 0x08, 0x40, 0xf9, /* ldr x2, [x0, #16] */
-	0x01, 0x04, 0x40, 0xf9, /* ldr x1, [x0, #8]  */
-	0xe8, 0x03, 0x00, 0xaa, /* mov x8, x0        */
-	0x00, 0x00, 0x40, 0xf9, /* ldr x0, [x0]      */
-	0xe9, 0x03, 0x1f, 0x2a, /* mov w9, wzr       */
+	0xf3, 0x53, 0xbc, 0xa9, /* stp x19, x20, [sp, #-64]! */
+	0xf5, 0x5b, 0x01, 0xa9, /* stp x21, x22, [sp, #16]   */
+	0xf7, 0x63, 0x02, 0xa9, /* stp x23, x24, [sp, #32]   */
+	0xf9, 0x6b, 0x03, 0xa9, /* stp x25, x26, [sp, #48]   */
+	0xe8, 0x03, 0x00, 0xaa, /* mov x8, x0                */
+	0xea, 0x03, 0x01, 0xaa, /* mov x10, x1               */
+	0xf1, 0x03, 0x1f, 0x2a, /* mov w17, wzr              */
+	0x5f, 0x09, 0x00, 0xf1, /* cmp x10, #2               */
+};
+
+/* executed once per pair of lanes */
+static const uint8_t a64_pair_prologue[] = {
+	0x0e, 0x01, 0x01, 0x91, /* add x14, x8, #64          */
+	0x07, 0x1d, 0x40, 0xf9, /* ldr x7, [x8, #56]         */
+	0x06, 0x19, 0x40, 0xf9, /* ldr x6, [x8, #48]         */
+	0x05, 0x15, 0x40, 0xf9, /* ldr x5, [x8, #40]         */
+	0x04, 0x11, 0x40, 0xf9, /* ldr x4, [x8, #32]         */
+	0x03, 0x0d, 0x40, 0xf9, /* ldr x3, [x8, #24]         */
+	0x02, 0x09, 0x40, 0xf9, /* ldr x2, [x8, #16]         */
+	0x01, 0x05, 0x40, 0xf9, /* ldr x1, [x8, #8]          */
+	0x00, 0x01, 0x40, 0xf9, /* ldr x0, [x8]              */
+	0xda, 0x1d, 0x40, 0xf9, /* ldr x26, [x14, #56]       */
+	0xd9, 0x19, 0x40, 0xf9, /* ldr x25, [x14, #48]       */
+	0xd8, 0x15, 0x40, 0xf9, /* ldr x24, [x14, #40]       */
+	0xd7, 0x11, 0x40, 0xf9, /* ldr x23, [x14, #32]       */
+	0xd6, 0x0d, 0x40, 0xf9, /* ldr x22, [x14, #24]       */
+	0xd5, 0x09, 0x40, 0xf9, /* ldr x21, [x14, #16]       */
+	0xd4, 0x05, 0x40, 0xf9, /* ldr x20, [x14, #8]        */
+	0xd3, 0x01, 0x40, 0xf9, /* ldr x19, [x14]            */
+	0xe9, 0x03, 0x1f, 0x2a, /* mov w9, wzr               */
+	0xed, 0x03, 0x1f, 0x2a, /* mov w13, wzr              */
+};
+
+/* executed once per pair of lanes, followed by "b.hs pair" */
+static const uint8_t a64_pair_epilogue[] = {
+	0x00, 0x01, 0x00, 0xf9, /* str x0, [x8]              */
+	0x01, 0x05, 0x00, 0xf9, /* str x1, [x8, #8]          */
+	0x02, 0x09, 0x00, 0xf9, /* str x2, [x8, #16]         */
+	0x03, 0x0d, 0x00, 0xf9, /* str x3, [x8, #24]         */
+	0x04, 0x11, 0x00, 0xf9, /* str x4, [x8, #32]         */
+	0x05, 0x15, 0x00, 0xf9, /* str x5, [x8, #40]         */
+	0x06, 0x19, 0x00, 0xf9, /* str x6, [x8, #48]         */
+	0x07, 0x1d, 0x00, 0xf9, /* str x7, [x8, #56]         */
+	0xd3, 0x01, 0x00, 0xf9, /* str x19, [x14]            */
+	0xd4, 0x05, 0x00, 0xf9, /* str x20, [x14, #8]        */
+	0xd5, 0x09, 0x00, 0xf9, /* str x21, [x14, #16]       */
+	0xd6, 0x0d, 0x00, 0xf9, /* str x22, [x14, #24]       */
+	0xd7, 0x11, 0x00, 0xf9, /* str x23, [x14, #32]       */
+	0xd8, 0x15, 0x00, 0xf9, /* str x24, [x14, #40]       */
+	0xd9, 0x19, 0x00, 0xf9, /* str x25, [x14, #48]       */
+	0xda, 0x1d, 0x00, 0xf9, /* str x26, [x14, #56]       */
+	0x31, 0x7e, 0x49, 0x0b, /* add w17, w17, w9, lsr #31 */
+	0x31, 0x7e, 0x4d, 0x0b, /* add w17, w17, w13, lsr #31 */
+	0x08, 0x01, 0x02, 0x91, /* add x8, x8, #128          */
+	0x4a, 0x09, 0x00, 0xd1, /* sub x10, x10, #2          */
+	0x5f, 0x09, 0x00, 0xf1, /* cmp x10, #2               */
+};
+
+/* executed for the odd lane, preceded by "cbz x10, done" */
+static const uint8_t a64_lane_prologue[] = {
+	0x07, 0x1d, 0x40, 0xf9, /* ldr x7, [x8, #56]         */
+	0x06, 0x19, 0x40, 0xf9, /* ldr x6, [x8, #48]         */
+	0x05, 0x15, 0x40, 0xf9, /* ldr x5, [x8, #40]         */
+	0x04, 0x11, 0x40, 0xf9, /* ldr x4, [x8, #32]         */
+	0x03, 0x0d, 0x40, 0xf9, /* ldr x3, [x8, #24]         */
+	0x02, 0x09, 0x40, 0xf9, /* ldr x2, [x8, #16]         */
+	0x01, 0x05, 0x40, 0xf9, /* ldr x1, [x8, #8]          */
+	0x00, 0x01, 0x40, 0xf9, /* ldr x0, [x8]              */
+	0xe9, 0x03, 0x1f, 0x2a, /* mov w9, wzr               */
+};
+
+static const uint8_t a64_lane_epilogue[] = {
+	0x00, 0x01, 0x00, 0xf9, /* str x0, [x8]              */
+	0x01, 0x05, 0x00, 0xf9, /* str x1, [x8, #8]          */
+	0x02, 0x09, 0x00, 0xf9, /* str x2, [x8, #16]         */
+	0x03, 0x0d, 0x00, 0xf9, /* str x3, [x8, #24]         */
+	0x04, 0x11, 0x00, 0xf9, /* str x4, [x8, #32]         */
+	0x05, 0x15, 0x00, 0xf9, /* str x5, [x8, #40]         */
+	0x06, 0x19, 0x00, 0xf9, /* str x6, [x8, #48]         */
+	0x07, 0x1d, 0x00, 0xf9, /* str x7, [x8, #56]         */
+	0x31, 0x7e, 0x49, 0x0b, /* add w17, w17, w9, lsr #31 */
 };
 
 static const uint8_t a64_epilogue[] = {
-	0x00, 0x01, 0x00, 0xf9, /* str x0, [x8]      */
-	0x01, 0x05, 0x00, 0xf9, /* str x1, [x8, #8]  */
-	0x02, 0x09, 0x00, 0xf9, /* str x2, [x8, #16] */
-	0x03, 0x0d, 0x00, 0xf9, /* str x3, [x8, #24] */
-	0x04, 0x11, 0x00, 0xf9, /* str x4, [x8, #32] */
-	0x05, 0x15, 0x00, 0xf9, /* str x5, [x8, #40] */
-	0x06, 0x19, 0x00, 0xf9, /* str x6, [x8, #48] */
-	0x07, 0x1d, 0x00, 0xf9, /* str x7, [x8, #56] */
-	0xc0, 0x03, 0x5f, 0xd6, /* ret               */
+	0xe0, 0x03, 0x11, 0x2a, /* mov w0, w17               */
+	0xf9, 0x6b, 0x43, 0xa9, /* ldp x25, x26, [sp, #48]   */
+	0xf7, 0x63, 0x42, 0xa9, /* ldp x23, x24, [sp, #32]   */
+	0xf5, 0x5b, 0x41, 0xa9, /* ldp x21, x22, [sp, #16]   */
+	0xf3, 0x53, 0xc4, 0xa8, /* ldp x19, x20, [sp], #64   */
+	0xc0, 0x03, 0x5f, 0xd6, /* ret                       */
 };
 
-void hashx_compile_a64(const hashx_program* program, uint8_t* code) {
-	hashx_vm_rw(code, COMP_CODE_SIZE);
-	uint8_t* pos = code;
+static inline uint32_t a64_rel19(const uint8_t* pos, const uint8_t* dst) {
+	return ((((uint32_t)(dst - pos)) >> 2) & 0x7FFFF) << 5;
+}
+
+static inline uint32_t a64_rel26(const uint8_t* pos, const uint8_t* dst) {
+	return (((uint32_t)(dst - pos)) >> 2) & 0x3FFFFFF;
+}
+
+/* Emits one instruction for the register file starting at x<base>.
+   Constants must already be loaded in x12. */
+static uint8_t* emit_op(uint8_t* pos, const instruction* instr, int base) {
+	uint32_t src = instr->src + base;
+	uint32_t dst = instr->dst + base;
+	switch (instr->opcode)
+	{
+	case INSTR_UMULH_R:
+		EMIT_U32(pos, 0x9bc07c00 | (src << 16) | (dst << 5) | dst);
+		break;
+	case INSTR_SMULH_R:
+		EMIT_U32(pos, 0x9b407c00 | (src << 16) | (dst << 5) | dst);
+		break;
+	case INSTR_MUL_R:
+		EMIT_U32(pos, 0x9b007c00 | (src << 16) | (dst << 5) | dst);
+		break;
+	case INSTR_SUB_R:
+		EMIT_U32(pos, 0xcb000000 | (src << 16) | (dst << 5) | dst);
+		break;
+	case INSTR_XOR_R:
+		EMIT_U32(pos, 0xca000000 | (src << 16) | (dst << 5) | dst);
+		break;
+	case INSTR_ADD_RS:
+		EMIT_U32(pos, 0x8b000000 | (src << 16) | (instr->imm32 << 10) |
+			(dst << 5) | dst);
+		break;
+	case INSTR_ROR_C:
+		EMIT_U32(pos, 0x93c00000 | (dst << 16) | (instr->imm32 << 10) |
+			(dst << 5) | dst);
+		break;
+	case INSTR_ADD_C:
+		EMIT_U32(pos, 0x8b0c0000 | (dst << 5) | dst);
+		break;
+	case INSTR_XOR_C:
+		EMIT_U32(pos, 0xca0c0000 | (dst << 5) | dst);
+		break;
+	default:
+		UNREACHABLE;
+	}
+	return pos;
+}
+
+/* Emits instructions [first, last) of the program, either for the
+   register file starting at x<base> or interleaved for both lanes when
+   'branches' is not NULL. Branches of the interleaved code are recorded in
+   'branches', because their stubs are emitted after the function. */
+static uint8_t* emit_program(const hashx_program* program, uint8_t* pos,
+	int first, int last, int base, a64_branch* branches)
+{
 	uint8_t* target = NULL;
+	int target_idx = 0;
 	int creg = -1;
-	EMIT(pos, a64_prologue);
-	for (int i = 0; i < program->code_size; ++i) {
+	for (int i = first; i < last; ++i) {
 		const instruction* instr = &program->code[i];
 		switch (instr->opcode)
 		{
 		case INSTR_UMULH_R:
-			EMIT_U32(pos, 0x9bc07c00 |
-				(instr->src << 16)   |
-				(instr->dst << 5)    |
-				(instr->dst));
-			if (target != NULL) {
-				creg = instr->dst;
-			}
-			break;
 		case INSTR_SMULH_R:
-			EMIT_U32(pos, 0x9b407c00 |
-				(instr->src << 16)   |
-				(instr->dst << 5)    |
-				(instr->dst));
 			if (target != NULL) {
 				creg = instr->dst;
 			}
 			break;
+		case INSTR_ADD_C:
+		case INSTR_XOR_C:
+			EMIT_IMM32(pos, instr->imm32);
+			/* fall through */
 		case INSTR_MUL_R:
-			assert(creg != instr->dst);
-			EMIT_U32(pos, 0x9b007c00 |
-				(instr->src << 16)   |
-				(instr->dst << 5)    |
-				(instr->dst));
-			break;
 		case INSTR_SUB_R:
-			assert(creg != instr->dst);
-			EMIT_U32(pos, 0xcb000000 |
-				(instr->src << 16)   |
-				(instr->dst << 5)    |
-				(instr->dst));
-			break;
 		case INSTR_XOR_R:
-			assert(creg != instr->dst);
-			EMIT_U32(pos, 0xca000000 |
-				(instr->src << 16)   |
-				(instr->dst << 5)    |
-				(instr->dst));
-			break;
 		case INSTR_ADD_RS:
-			assert(creg != instr->dst);
-			EMIT_U32(pos, 0x8b000000 |
-				(instr->src << 16)   |
-				(instr->imm32 << 10) |
-				(instr->dst << 5)    |
-				(instr->dst));
-			break;
 		case INSTR_ROR_C:
 			assert(creg != instr->dst);
-			EMIT_U32(pos, 0x93c00000 |
-				(instr->dst << 16)   |
-				(instr->imm32 << 10) |
-				(instr->dst << 5)    |
-				(instr->dst));
-			break;
-		case INSTR_ADD_C:
-			assert(creg != instr->dst);
-			EMIT_IMM32(pos, instr->imm32);
-			EMIT_U32(pos, 0x8b0c0000 |
-				(instr->dst << 5) |
-				(instr->dst));
-			break;
-		case INSTR_XOR_C:
-			assert(creg != instr->dst);
-			EMIT_IMM32(pos, instr->imm32);
-			EMIT_U32(pos, 0xca0c0000 |
-				(instr->dst << 5) |
-				(instr->dst));
 			break;
 		case INSTR_TARGET:
 			target = pos;
-			break;
+			target_idx = i;
+			continue;
 		case INSTR_BRANCH:
 			EMIT_IMM32(pos, instr->imm32);
 			EMIT_U32(pos, 0x2a00012b | (creg << 16));
 			EMIT_U32(pos, 0x6a0c017f);
 			EMIT_U32(pos, 0x5a891129);
-			EMIT_U32(pos, 0x54000000 |
-				((((uint32_t)(target - pos)) >> 2) & 0x7FFFF) << 5);
+			if (branches == NULL) {
+				assert(base == 0);
+				EMIT_U32(pos, 0x54000000 | a64_rel19(pos, target));
+			}
+			else {
+				/* cset w15, eq; orr w11, w13, w<creg B>; tst w11, w12;
+				   csinv w13, w13, w13, ne */
+				EMIT_U32(pos, 0x1a9f17ef);
+				EMIT_U32(pos, 0x2a0001ab | ((creg + A64_LANE_B) << 16));
+				EMIT_U32(pos, 0x6a0c017f);
+				EMIT_U32(pos, 0x5a8d11ad);
+				/* cbnz w15, stub A; b.eq stub B */
+				branches->site = pos;
+				branches->target = target;
+				branches->first = target_idx + 1;
+				branches->last = i;
+				branches++;
+				EMIT_U32(pos, 0x3500000f);
+				EMIT_U32(pos, 0x54000000);
+			}
 			target = NULL;
 			creg = -1;
-			break;
+			continue;
 		default:
 			UNREACHABLE;
 		}
+		if (branches == NULL) {
+			pos = emit_op(pos, instr, base);
+		}
+		else {
+			pos = emit_op(pos, instr, 0);
+			pos = emit_op(pos, instr, A64_LANE_B);
+		}
 	}
+	return pos;
+}
+
+void hashx_compile_a64(const hashx_program* program, hashx_ctx* ctx) {
+	/* code is written through the writable alias of ctx->code */
+	uint8_t* code = ctx->code_rw;
+	hashx_compiler_rw(ctx);
+	uint8_t* pos = code;
+	a64_branch branches[A64_MAX_BRANCHES];
+	uint8_t *pair, *tail, *done, *fixup;
+	EMIT(pos, a64_prologue);
+	fixup = pos;
+	EMIT_U32(pos, 0x54000003); /* b.lo tail */
+	pair = pos;
+	EMIT(pos, a64_pair_prologue);
+	pos = emit_program(program, pos, 0, program->code_size, 0, branches);
+	EMIT(pos, a64_pair_epilogue);
+	EMIT_U32(pos, 0x54000002 | a64_rel19(pos, pair)); /* b.hs pair */
+	tail = pos;
+	*(uint32_t*)fixup |= a64_rel19(fixup, tail);
+	EMIT_U32(pos, 0xb400000a); /* cbz x10, done */
+	EMIT(pos, a64_lane_prologue);
+	pos = emit_program(program, pos, 0, program->code_size, 0, NULL);
+	EMIT(pos, a64_lane_epilogue);
+	done = pos;
+	*(uint32_t*)tail |= a64_rel19(tail, done);
 	EMIT(pos, a64_epilogue);
-	hashx_vm_rx(code, COMP_CODE_SIZE);
+	/* Stubs for branches taken by only one of the interleaved lanes.
+	   That lane repeats the block on its own and then rejoins the
+	   interleaved code, which is safe because a lane takes at most one
+	   branch. Stub A also handles both lanes taking the branch, since
+	   the flags still hold the condition of lane B. */
+	assert(program->branch_count <= A64_MAX_BRANCHES);
+	for (int i = 0; i < program->branch_count; ++i) {
+		a64_branch* branch = &branches[i];
+		uint8_t* next = branch->site + 8;
+		*(uint32_t*)branch->site |= a64_rel19(branch->site, pos);
+		EMIT_U32(pos, 0x54000000 | a64_rel19(pos, branch->target));
+		pos = emit_program(program, pos, branch->first, branch->last, 0,
+			NULL);
+		EMIT_U32(pos, 0x14000000 | a64_rel26(pos, next));
+		*(uint32_t*)(branch->site + 4) |= a64_rel19(branch->site + 4, pos);
+		pos = emit_program(program, pos, branch->first, branch->last,
+			A64_LANE_B, NULL);
+		EMIT_U32(pos, 0x14000000 | a64_rel26(pos, next));
+	}
+	ctx->code_length = pos - code;
+	hashx_compiler_rx(ctx);
 #ifdef __GNUC__
-	__builtin___clear_cache(code, pos);
+	__builtin___clear_cache((char*)ctx->code,
+		(char*)ctx->code + (pos - code));
 #endif
+	/* the instruction symbols use x86 mnemonics, so only the function
+	   is described */
+	if (hashx_perf_map_level()) {
+		hashx_perf_map_add(ctx->code, ctx->code_length,
+			"hashx_program_func", program, NULL);
+	}
 }
 
 #endif
@@ -7,6 +7,9 @@
 #include "program.h"
 #include "virtual_memory.h"
 #include "unreachable.h"
+#include "context.h"
+#include "cpu.h"
+#include "perf_map.h"
 
 #if defined(_WIN32) || defined(__CYGWIN__)
 #define WINABI
@@ -28,22 +31,43 @@
 static const uint8_t x86_prologue[] = {
 #ifndef WINABI
 	0x48, 0x89, 0xF9,             /* mov rcx, rdi */
-	0x48, 0x83, 0xEC, 0x20,       /* sub rsp, 32 */
+	0x48, 0x83, 0xEC, 0x30,       /* sub rsp, 48 */
 	0x4C, 0x89, 0x24, 0x24,       /* mov qword ptr [rsp+0], r12 */
 	0x4C, 0x89, 0x6C, 0x24, 0x08, /* mov qword ptr [rsp+8], r13 */
 	0x4C, 0x89, 0x74, 0x24, 0x10, /* mov qword ptr [rsp+16], r14 */
 	0x4C, 0x89, 0x7C, 0x24, 0x18, /* mov qword ptr [rsp+24], r15 */
+	0x48, 0xC1, 0xE6, 0x06,       /* shl rsi, 6 */
+	0x48, 0x01, 0xFE,             /* add rsi, rdi */
+	0x48, 0x89, 0x74, 0x24, 0x20, /* mov qword ptr [rsp+32], rsi */
+	0xC7, 0x44, 0x24, 0x28,       /* mov dword ptr [rsp+40], 0 */
+	0x00, 0x00, 0x00, 0x00,
 #else
 	0x4C, 0x89, 0x64, 0x24, 0x08, /* mov qword ptr [rsp+8], r12 */
 	0x4C, 0x89, 0x6C, 0x24, 0x10, /* mov qword ptr [rsp+16], r13 */
 	0x4C, 0x89, 0x74, 0x24, 0x18, /* mov qword ptr [rsp+24], r14 */
 	0x4C, 0x89, 0x7C, 0x24, 0x20, /* mov qword ptr [rsp+32], r15 */
-	0x48, 0x83, 0xEC, 0x10,       /* sub rsp, 16 */
+	0x48, 0x83, 0xEC, 0x20,       /* sub rsp, 32 */
 	0x48, 0x89, 0x34, 0x24,       /* mov qword ptr [rsp+0], rsi */
 	0x48, 0x89, 0x7C, 0x24, 0x08, /* mov qword ptr [rsp+8], rdi */
+	0x48, 0xC1, 0xE2, 0x06,       /* shl rdx, 6 */
+	0x48, 0x01, 0xCA,             /* add rdx, rcx */
+	0x48, 0x89, 0x54, 0x24, 0x10, /* mov qword ptr [rsp+16], rdx */
+	0xC7, 0x44, 0x24, 0x18,       /* mov dword ptr [rsp+24], 0 */
+	0x00, 0x00, 0x00, 0x00,
 #endif
+};
+
+/* initial state of the branch condition */
+static const uint8_t x86_branch_init[] = {
 	0x31, 0xF6,                   /* xor esi, esi */
 	0x8D, 0x7E, 0xFF,             /* lea edi, [rsi-1] */
+};
+
+/* Executed once per lane. The lanes run back to back: two register files
+   do not fit in the x86-64 registers, and a program has 192 multiplications
+   for a latency of about 195 cycles, so cores with a single 64-bit
+   multiplier are already port-bound on one lane. */
+static const uint8_t x86_lane_prologue[] = {
 	0x4C, 0x8B, 0x01,             /* mov r8, qword ptr [rcx+0] */
 	0x4C, 0x8B, 0x49, 0x08,       /* mov r9, qword ptr [rcx+8] */
 	0x4C, 0x8B, 0x51, 0x10,       /* mov r10, qword ptr [rcx+16] */
@@ -54,7 +78,8 @@ static const uint8_t x86_prologue[] = {
 	0x4C, 0x8B, 0x79, 0x38        /* mov r15, qword ptr [rcx+56] */
 };
 
-static const uint8_t x86_epilogue[] = {
+/* executed once per lane, followed by a jump to the lane prologue */
+static const uint8_t x86_lane_epilogue[] = {
 	0x4C, 0x89, 0x01,             /* mov qword ptr [rcx+0], r8 */
 	0x4C, 0x89, 0x49, 0x08,       /* mov qword ptr [rcx+8], r9 */
 	0x4C, 0x89, 0x51, 0x10,       /* mov qword ptr [rcx+16], r10 */
@@ -63,16 +88,74 @@ static const uint8_t x86_epilogue[] = {
 	0x4C, 0x89, 0x69, 0x28,       /* mov qword ptr [rcx+40], r13 */
 	0x4C, 0x89, 0x71, 0x30,       /* mov qword ptr [rcx+48], r14 */
 	0x4C, 0x89, 0x79, 0x38,       /* mov qword ptr [rcx+56], r15 */
+	0x48, 0x83, 0xC1, 0x40,       /* add rcx, 64 */
+#ifndef WINABI
+	0x29, 0x74, 0x24, 0x28,       /* sub dword ptr [rsp+40], esi */
+	0x48, 0x3B, 0x4C, 0x24, 0x20, /* cmp rcx, qword ptr [rsp+32] */
+#else
+	0x29, 0x74, 0x24, 0x18,       /* sub dword ptr [rsp+24], esi */
+	0x48, 0x3B, 0x4C, 0x24, 0x10, /* cmp rcx, qword ptr [rsp+16] */
+#endif
+};
+
+/* the return value is the number of branches taken */
+static const uint8_t x86_branch_count[] = {
+#ifndef WINABI
+	0x8B, 0x44, 0x24, 0x28,       /* mov eax, dword ptr [rsp+40] */
+#else
+	0x8B, 0x44, 0x24, 0x18,       /* mov eax, dword ptr [rsp+24] */
+#endif
+};
+
+#ifndef HASHX_BLOCK_MODE
+/* hash_func(input, output) */
+static const uint8_t x86_hash_prologue[] = {
+#ifndef WINABI
+	0x48, 0x89, 0xF9,             /* mov rcx, rdi */
+	0x48, 0x83, 0xEC, 0x30,       /* sub rsp, 48 */
+	0x4C, 0x89, 0x24, 0x24,       /* mov qword ptr [rsp+0], r12 */
+	0x4C, 0x89, 0x6C, 0x24, 0x08, /* mov qword ptr [rsp+8], r13 */
+	0x4C, 0x89, 0x74, 0x24, 0x10, /* mov qword ptr [rsp+16], r14 */
+	0x4C, 0x89, 0x7C, 0x24, 0x18, /* mov qword ptr [rsp+24], r15 */
+	0x48, 0x89, 0x74, 0x24, 0x20, /* mov qword ptr [rsp+32], rsi */
+#else
+	0x4C, 0x89, 0x64, 0x24, 0x08, /* mov qword ptr [rsp+8], r12 */
+	0x4C, 0x89, 0x6C, 0x24, 0x10, /* mov qword ptr [rsp+16], r13 */
+	0x4C, 0x89, 0x74, 0x24, 0x18, /* mov qword ptr [rsp+24], r14 */
+	0x4C, 0x89, 0x7C, 0x24, 0x20, /* mov qword ptr [rsp+32], r15 */
+	0x48, 0x83, 0xEC, 0x20,       /* sub rsp, 32 */
+	0x48, 0x89, 0x34, 0x24,       /* mov qword ptr [rsp+0], rsi */
+	0x48, 0x89, 0x7C, 0x24, 0x08, /* mov qword ptr [rsp+8], rdi */
+	0x48, 0x89, 0x54, 0x24, 0x10, /* mov qword ptr [rsp+16], rdx */
+#endif
+};
+
+static const uint8_t x86_hash_output[] = {
+#ifndef WINABI
+	0x48, 0x8B, 0x4C, 0x24, 0x20, /* mov rcx, qword ptr [rsp+32] */
+#else
+	0x48, 0x8B, 0x4C, 0x24, 0x10, /* mov rcx, qword ptr [rsp+16] */
+#endif
+};
+
+/* the return value is 1 if the branch state is -1 (a branch was taken) */
+static const uint8_t x86_hash_branch_count[] = {
+	0x89, 0xF0,                   /* mov eax, esi */
+	0xF7, 0xD8,                   /* neg eax */
+};
+#endif
+
+static const uint8_t x86_epilogue[] = {
 #ifndef WINABI
 	0x4C, 0x8B, 0x24, 0x24,       /* mov r12, qword ptr [rsp+0] */
 	0x4C, 0x8B, 0x6C, 0x24, 0x08, /* mov r13, qword ptr [rsp+8] */
 	0x4C, 0x8B, 0x74, 0x24, 0x10, /* mov r14, qword ptr [rsp+16] */
 	0x4C, 0x8B, 0x7C, 0x24, 0x18, /* mov r15, qword ptr [rsp+24] */
-	0x48, 0x83, 0xC4, 0x20,       /* add rsp, 32 */
+	0x48, 0x83, 0xC4, 0x30,       /* add rsp, 48 */
 #else
 	0x48, 0x8B, 0x34, 0x24,       /* mov rsi, qword ptr [rsp+0] */
 	0x48, 0x8B, 0x7C, 0x24, 0x08, /* mov rdi, qword ptr [rsp+8] */
-	0x48, 0x83, 0xC4, 0x10,       /* add rsp, 16 */
+	0x48, 0x83, 0xC4, 0x20,       /* add rsp, 32 */
 	0x4C, 0x8B, 0x64, 0x24, 0x08, /* mov r12, qword ptr [rsp+8] */
 	0x4C, 0x8B, 0x6C, 0x24, 0x10, /* mov r13, qword ptr [rsp+16] */
 	0x4C, 0x8B, 0x74, 0x24, 0x18, /* mov r14, qword ptr [rsp+24] */
@@ -81,16 +164,87 @@ static const uint8_t x86_epilogue[] = {
 	0xC3                          /* ret */
 };
 
-void hashx_compile_x86(const hashx_program* program, uint8_t* code) {
-	hashx_vm_rw(code, COMP_CODE_SIZE);
-	uint8_t* pos = code;
+/*
+ * With BMI2, UMULH is compiled as "mov rdx, dst; mulx dst, dst, src".
+ * The result is then not in edx, which is tested by INSTR_BRANCH, so
+ * the branch copies it from the register of the last multiplication.
+ * If that register is overwritten before a branch that depends on it,
+ * the result is copied to edx right after the multiplication instead.
+ * There is no signed variant of mulx and the equivalent sequence is much
+ * longer than one-operand imul, so SMULH is compiled the same way in both
+ * cases.
+ */
+static void find_result_copies(const hashx_program* program,
+	bool copy[HASHX_PROGRAM_MAX_SIZE]) {
+	/* registers overwritten between an instruction and the next branch
+	   that uses the result of the last multiplication before it */
+	uint32_t clobbered = 0;
+	bool branch_follows = false;
+	for (int i = (int)program->code_size - 1; i >= 0; --i) {
+		const instruction* instr = &program->code[i];
+		copy[i] = false;
+		switch (instr->opcode)
+		{
+		case INSTR_UMULH_R:
+		case INSTR_SMULH_R:
+			copy[i] = branch_follows && (clobbered & (1U << instr->dst));
+			branch_follows = false;
+			clobbered = 0;
+			break;
+		case INSTR_BRANCH:
+			branch_follows = true;
+			break;
+		case INSTR_TARGET:
+			break;
+		default:
+			if (branch_follows) {
+				clobbered |= 1U << instr->dst;
+			}
+			break;
+		}
+	}
+}
+
+/* If 'offsets' is not NULL, the offsets of the instructions from 'base'
+   are stored for the perf map. */
+static uint8_t* emit_program(const hashx_program* program, uint8_t* pos,
+	bool bmi2, uint32_t* offsets, const uint8_t* base) {
 	uint8_t* target = NULL;
-	EMIT(pos, x86_prologue);
+	bool copy[HASHX_PROGRAM_MAX_SIZE];
+	/* register with the result of the last multiplication if it's not
+	   in edx */
+	int result = -1;
+	if (bmi2) {
+		find_result_copies(program, copy);
+	}
 	for (int i = 0; i < program->code_size; ++i) {
 		const instruction* instr = &program->code[i];
+		if (offsets != NULL) {
+			offsets[i] = (uint32_t)(pos - base);
+		}
 		switch (instr->opcode)
 		{
 		case INSTR_UMULH_R:
+			if (bmi2) {
+				/* mov rdx, dst */
+				EMIT_U16(pos, 0x894c);
+				EMIT_BYTE(pos, 0xc2 | (instr->dst << 3));
+				/* mulx dst, dst, src */
+				EMIT_U16(pos, 0x42c4);
+				EMIT_BYTE(pos, 0x83 | ((7 - instr->dst) << 3));
+				EMIT_BYTE(pos, 0xf6);
+				EMIT_BYTE(pos, 0xc0 | (instr->dst << 3) | instr->src);
+				if (copy[i]) {
+					/* mov edx, dst */
+					EMIT_U16(pos, 0x8944);
+					EMIT_BYTE(pos, 0xc2 | (instr->dst << 3));
+					result = -1;
+				}
+				else {
+					result = instr->dst;
+				}
+				break;
+			}
 			EMIT_U64(pos, 0x8b4ce0f749c08b49 |
 				(((uint64_t)instr->src) << 40) |
 				(((uint64_t)instr->dst) << 16));
@@ -101,6 +255,7 @@ void hashx_compile_x86(const hashx_program* program, uint8_t* code) {
 				(((uint64_t)instr->src) << 40) |
 				(((uint64_t)instr->dst) << 16));
 			EMIT_BYTE(pos, 0xc2 + 8 * instr->dst);
+			result = -1;
 			break;
 		case INSTR_MUL_R:
 			EMIT_U32(pos, 0xc0af0f4d | (instr->dst << 27) | (instr->src << 24));
@@ -137,6 +292,11 @@ void hashx_compile_x86(const hashx_program* program, uint8_t* code) {
 			EMIT_BYTE(pos, 0xf7);
 			break;
 		case INSTR_BRANCH:
+			if (result >= 0) {
+				/* mov edx, result */
+				EMIT_U16(pos, 0x8944);
+				EMIT_BYTE(pos, 0xc2 | (result << 3));
+			}
 			EMIT_U64(pos, ((uint64_t)instr->imm32) << 32 | 0xc2f7f209);
 			EMIT_U16(pos, ((target - pos) << 8) | 0x74);
 			break;
@@ -144,8 +304,193 @@ void hashx_compile_x86(const hashx_program* program, uint8_t* code) {
 			UNREACHABLE;
 		}
 	}
+	if (offsets != NULL) {
+		offsets[program->code_size] = (uint32_t)(pos - base);
+	}
+	return pos;
+}
+
+#ifndef HASHX_BLOCK_MODE
+/* x86 register numbers of r8-r15 are 0-7 with the REX.B/REX.R prefix bit */
+
+static uint8_t* emit_mov_imm64(uint8_t* pos, int reg, uint64_t imm) {
+	EMIT_BYTE(pos, 0x49);
+	EMIT_BYTE(pos, 0xb8 | reg);
+	EMIT_U64(pos, imm);
+	return pos;
+}
+
+static uint8_t* emit_reg_op(uint8_t* pos, uint8_t opcode, int dst, int src) {
+	EMIT_BYTE(pos, 0x4d);
+	EMIT_BYTE(pos, opcode);
+	EMIT_BYTE(pos, 0xc0 | (src << 3) | dst);
+	return pos;
+}
+
+#define ADD_R 0x01
+#define XOR_R 0x31
+#define MOV_R 0x89
+
+static uint8_t* emit_shift(uint8_t* pos, uint8_t opcode, int reg, int bits) {
+	EMIT_BYTE(pos, 0x49);
+	EMIT_BYTE(pos, 0xc1);
+	EMIT_BYTE(pos, opcode | reg);
+	EMIT_BYTE(pos, bits);
+	return pos;
+}
+
+#define ROL_C 0xc0
+#define SHR_C 0xe8
+
+static uint8_t* emit_xor_imm32(uint8_t* pos, int reg, uint32_t imm) {
+	EMIT_U16(pos, 0x8149);
+	EMIT_BYTE(pos, 0xf0 | reg);
+	EMIT_U32(pos, imm);
+	return pos;
+}
+
+static uint8_t* emit_add_imm64(uint8_t* pos, int reg, uint64_t imm) {
+	EMIT_U16(pos, 0xb848); /* mov rax, imm64 */
+	EMIT_U64(pos, imm);
+	EMIT_U16(pos, 0x0149); /* add reg, rax */
+	EMIT_BYTE(pos, 0xc0 | reg);
+	return pos;
+}
+
+static uint8_t* emit_sipround(uint8_t* pos, int v0, int v1, int v2, int v3) {
+	pos = emit_reg_op(pos, ADD_R, v0, v1);
+	pos = emit_reg_op(pos, ADD_R, v2, v3);
+	pos = emit_shift(pos, ROL_C, v1, 13);
+	pos = emit_shift(pos, ROL_C, v3, 16);
+	pos = emit_reg_op(pos, XOR_R, v1, v0);
+	pos = emit_reg_op(pos, XOR_R, v3, v2);
+	pos = emit_shift(pos, ROL_C, v0, 32);
+	pos = emit_reg_op(pos, ADD_R, v2, v1);
+	pos = emit_reg_op(pos, ADD_R, v0, v3);
+	pos = emit_shift(pos, ROL_C, v1, 17);
+	pos = emit_shift(pos, ROL_C, v3, 21);
+	pos = emit_reg_op(pos, XOR_R, v1, v2);
+	pos = emit_reg_op(pos, XOR_R, v3, v0);
+	pos = emit_shift(pos, ROL_C, v2, 32);
+	return pos;
+}
+
+/* mov [rcx+offset], reg (size = 1, 2, 4 or 8 bytes) */
+static uint8_t* emit_store(uint8_t* pos, int reg, int offset, int size) {
+	if (size == 2) {
+		EMIT_BYTE(pos, 0x66);
+	}
+	EMIT_BYTE(pos, size == 8 ? 0x4c : 0x44);
+	EMIT_BYTE(pos, size == 1 ? 0x88 : 0x89);
+	EMIT_BYTE(pos, 0x41 | (reg << 3));
+	EMIT_BYTE(pos, offset);
+	return pos;
+}
+
+/* Hash function for a counter value: hashx_siphash24_ctr_state512 with
+   the keys as immediate values, the program and the finalization. */
+static uint8_t* emit_hash_func(const hashx_program* program,
+	const siphash_state* keys, uint8_t* pos, bool bmi2, uint32_t* offsets) {
+	uint8_t* start = pos;
+	EMIT(pos, x86_hash_prologue);
+	/* rcx = input */
+	pos = emit_mov_imm64(pos, 0, keys->v0);
+	pos = emit_mov_imm64(pos, 1, keys->v1 ^ 0xee);
+	pos = emit_mov_imm64(pos, 2, keys->v2);
+	pos = emit_mov_imm64(pos, 3, keys->v3);
+	EMIT_U16(pos, 0x3149); /* xor r11, rcx */
+	EMIT_BYTE(pos, 0xcb);
+	pos = emit_sipround(pos, 0, 1, 2, 3);
+	pos = emit_sipround(pos, 0, 1, 2, 3);
+	EMIT_U16(pos, 0x3149); /* xor r8, rcx */
+	EMIT_BYTE(pos, 0xc8);
+	pos = emit_xor_imm32(pos, 2, 0xee);
+	for (int i = 0; i < 4; ++i) {
+		pos = emit_sipround(pos, 0, 1, 2, 3);
+	}
+	for (int i = 0; i < 4; ++i) {
+		pos = emit_reg_op(pos, MOV_R, 4 + i, i);
+	}
+	pos = emit_xor_imm32(pos, 5, 0xdd);
+	for (int i = 0; i < 4; ++i) {
+		pos = emit_sipround(pos, 4, 5, 6, 7);
+	}
+	EMIT(pos, x86_branch_init);
+	pos = emit_program(program, pos, bmi2, offsets, start);
+	/* finalization */
+	pos = emit_add_imm64(pos, 0, keys->v0);
+	pos = emit_add_imm64(pos, 1, keys->v1);
+	pos = emit_add_imm64(pos, 6, keys->v2);
+	pos = emit_add_imm64(pos, 7, keys->v3);
+	pos = emit_sipround(pos, 0, 1, 2, 3);
+	pos = emit_sipround(pos, 4, 5, 6, 7);
+	for (int i = 0; i < 4; ++i) {
+		pos = emit_reg_op(pos, XOR_R, i, 4 + i);
+	}
+	EMIT(pos, x86_hash_output);
+	/* rcx = output */
+	int offset = 0, word = 0;
+	for (; offset + 8 <= HASHX_SIZE; offset += 8) {
+		pos = emit_store(pos, word++, offset, 8);
+	}
+	for (int size = 4; size > 0; size /= 2) {
+		if (HASHX_SIZE - offset >= size) {
+			pos = emit_store(pos, word, offset, size);
+			offset += size;
+			if (offset < HASHX_SIZE) {
+				pos = emit_shift(pos, SHR_C, word, size * 8);
+			}
+		}
+	}
+	EMIT(pos, x86_hash_branch_count);
+	EMIT(pos, x86_epilogue);
+	return pos;
+}
+#endif
+
+void hashx_compile_x86(const hashx_program* program, hashx_ctx* ctx) {
+	/* code is written through the writable alias of ctx->code */
+	uint8_t* code = ctx->code_rw;
+	hashx_compiler_rw(ctx);
+	bool bmi2 = (hashx_cpu_features() & HASHX_CPU_BMI2) != 0;
+	int perf_map = hashx_perf_map_level();
+	uint32_t func_offsets[HASHX_PROGRAM_MAX_SIZE + 1];
+	uint32_t* offsets = NULL;
+	if (perf_map >= HASHX_PERF_MAP_INSTRS) {
+		offsets = func_offsets;
+	}
+	uint8_t* pos = code;
+	uint8_t* lane;
+	EMIT(pos, x86_prologue);
+	lane = pos;
+	EMIT(pos, x86_branch_init);
+	EMIT(pos, x86_lane_prologue);
+	pos = emit_program(program, pos, bmi2, offsets, code);
+	EMIT(pos, x86_lane_epilogue);
+	EMIT_U16(pos, 0x820f); /* jb lane */
+	EMIT_U32(pos, lane - (pos + sizeof(uint32_t)));
+	EMIT(pos, x86_branch_count);
 	EMIT(pos, x86_epilogue);
-	hashx_vm_rx(code, COMP_CODE_SIZE);
+	size_t func_size = pos - code;
+#ifndef HASHX_BLOCK_MODE
+	uint32_t hash_offsets[HASHX_PROGRAM_MAX_SIZE + 1];
+	pos = code + ALIGN_SIZE(pos - code, COMP_FUNC_ALIGN);
+	ctx->hash = (hash_func*)(ctx->code + (pos - code));
+	pos = emit_hash_func(program, &ctx->keys, pos, bmi2,
+		offsets != NULL ? hash_offsets : NULL);
+#endif
+	ctx->code_length = pos - code;
+	hashx_compiler_rx(ctx);
+	if (perf_map) {
+		hashx_perf_map_add(ctx->code, func_size, "hashx_program_func",
+			program, offsets);
+#ifndef HASHX_BLOCK_MODE
+		const uint8_t* hash = (const uint8_t*)ctx->hash;
+		hashx_perf_map_add(hash, ctx->code + ctx->code_length - hash,
+			"hashx_hash_func", program,
+			offsets != NULL ? hash_offsets : NULL);
+#endif
+	}
 }
 
 #endif
@@ -3,6 +3,7 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <assert.h>
 
 #include <hashx.h>
 #include "context.h"
@@ -33,6 +34,10 @@ const blake2b_param hashx_blake2_params = {
 };
 
 hashx_ctx* hashx_alloc(hashx_type type) {
+	return hashx_alloc_arena(type, NULL);
+}
+
+hashx_ctx* hashx_alloc_arena(hashx_type type, hashx_arena* arena) {
 	if (!HASHX_COMPILER && (type & HASHX_COMPILED)) {
 		return HASHX_NOTSUPP;
 	}
@@ -41,18 +46,32 @@ hashx_ctx* hashx_alloc(hashx_type type) {
 		goto failure;
 	}
 	ctx->code = NULL;
+	ctx->code_length = 0;
+	ctx->decoded = NULL;
+	ctx->arena = NULL;
+	ctx->cache_entry = NULL;
+	memset(&ctx->info, 0, sizeof(ctx->info));
+	memset(&ctx->stats, 0, sizeof(ctx->stats));
+	ctx->stats_enabled = 0;
+#ifndef HASHX_BLOCK_MODE
+	ctx->hash = NULL;
+#endif
+	/* the type is set first, so hashx_free can release a partially
+	   allocated instance */
 	if (type & HASHX_COMPILED) {
+		ctx->type = HASHX_COMPILED;
+		ctx->arena = arena;
 		if (!hashx_compiler_init(ctx)) {
 			goto failure;
 		}
-		ctx->type = HASHX_COMPILED;
 	}
 	else {
+		ctx->type = HASHX_INTERPRETED;
 		ctx->program = malloc(sizeof(hashx_program));
-		if (ctx->program == NULL) {
+		ctx->decoded = malloc(sizeof(hashx_decoded_program));
+		if (ctx->program == NULL || ctx->decoded == NULL) {
 			goto failure;
 		}
-		ctx->type = HASHX_INTERPRETED;
 	}
 #ifdef HASHX_BLOCK_MODE
 	memcpy(&ctx->params, &hashx_blake2_params, 32);
@@ -76,6 +95,27 @@ void hashx_free(hashx_ctx* ctx) {
 				free(ctx->program);
 			}
 		}
+		free(ctx->decoded);
 		free(ctx);
 	}
 }
+
+hashx_arena* hashx_arena_alloc(size_t capacity) {
+	return hashx_vm_arena_create(COMP_CODE_SIZE, capacity);
+}
+
+void hashx_arena_begin(hashx_arena* arena) {
+	assert(arena != NULL);
+	hashx_vm_arena_rw(arena);
+}
+
+void hashx_arena_end(hashx_arena* arena) {
+	assert(arena != NULL);
+	hashx_vm_arena_rx(arena);
+}
+
+void hashx_arena_free(hashx_arena* arena) {
+	if (arena != NULL) {
+		hashx_vm_arena_destroy(arena);
+	}
+}
@@ -9,8 +9,15 @@
 #include "hashx.h"
 #include "blake2.h"
 #include "siphash.h"
+#include "program.h"
 
-typedef void program_func(uint64_t r[8]);
+/* Compiled program. Executes the program for 'count' (at least 1)
+   consecutive register files and returns the number of branches taken. */
+typedef size_t program_func(uint64_t r[][8], size_t count);
+
+/* Compiled hash function for counter mode. Calculates the same result
+   as hashx_exec and returns the number of branches taken. */
+typedef int hash_func(uint64_t input, void* output);
 
 #ifdef __cplusplus
 extern "C" {
@@ -18,12 +25,44 @@ extern "C" {
 
 HASHX_PRIVATE extern const blake2b_param hashx_blake2_params;
 
+/* Derives the program and hash keys from a seed. hashx_make is equivalent
+   to hashx_seed_keys followed by hashx_make_keys. */
+HASHX_PRIVATE void hashx_seed_keys(const void* seed, size_t size,
+	siphash_state keys[2]);
+HASHX_PRIVATE int hashx_make_keys(hashx_ctx* ctx, siphash_state keys[2]);
+
+/* Number of instances currently kept in a cache. */
+HASHX_PRIVATE size_t hashx_cache_size(hashx_cache* cache);
+
 #ifdef __cplusplus
 }
 #endif
 
 typedef struct hashx_program hashx_program;
 
+/* Generated HashX function that is not attached to a context. */
+typedef struct hashx_func {
+	hashx_program program;
+	siphash_state keys;
+#ifndef NDEBUG
+	bool has_program;
+#endif
+} hashx_func;
+
+/* BLAKE2b state after absorbing a seed prefix. */
+typedef struct hashx_prefix {
+	blake2b_state state;
+#ifndef NDEBUG
+	bool has_prefix;
+#endif
+} hashx_prefix;
+
+/* BLAKE2b-4r state of a block mode input absorbed in parts. */
+typedef struct hashx_stream {
+	const hashx_ctx* ctx;
+	blake2b_state state;
+} hashx_stream;
+
 /* HashX context. */
 typedef struct hashx_ctx {
 	union {
@@ -31,12 +70,27 @@ typedef struct hashx_ctx {
 		program_func* func;
 		hashx_program* program;
 	};
+	/* Writable view of the code. It is a separate mapping of the same
+	   memory if the code is dual-mapped, otherwise it's equal to code. */
+	uint8_t* code_rw;
+	/* number of bytes of code emitted by the compiler */
+	size_t code_length;
 	hashx_type type;
+	/* pre-decoded program of an interpreted instance */
+	hashx_decoded_program* decoded;
+	hashx_arena* arena;
+	struct cache_entry* cache_entry;
 #ifndef HASHX_BLOCK_MODE
+	hash_func* hash;
 	siphash_state keys;
 #else
 	blake2b_param params;
 #endif
+	hashx_program_info info;
+	/* updated atomically, execs and branches only if stats_enabled */
+	hashx_stats stats;
+	/* atomic flag, see hashx_atomic_load_flag */
+	uint32_t stats_enabled;
 #ifndef NDEBUG
 	bool has_program;
 #endif
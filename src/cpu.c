@@ -0,0 +1,123 @@
+/* Copyright (c) 2020 tevador <tevador@gmail.com> */
+/* See LICENSE for licensing information */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cpu.h"
+
+#ifdef HASHX_SIMD_X86
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+
+static void cpuid(uint32_t leaf, uint32_t subleaf, uint32_t regs[4]) {
+#ifdef _MSC_VER
+	__cpuidex((int*)regs, (int)leaf, (int)subleaf);
+#else
+	__cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+static uint64_t xgetbv(void) {
+#ifdef _MSC_VER
+	return _xgetbv(0);
+#else
+	uint32_t eax, edx;
+	__asm__ volatile ("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+	return ((uint64_t)edx << 32) | eax;
+#endif
+}
+
+/* XCR0: SSE and AVX state */
+#define XCR0_AVX 0x06
+/* XCR0: SSE, AVX, opmask and ZMM state */
+#define XCR0_AVX512 0xe6
+
+static unsigned detect_features(void) {
+	unsigned features = 0;
+	uint32_t regs[4];
+	cpuid(0, 0, regs);
+	uint32_t max_leaf = regs[0];
+	cpuid(1, 0, regs);
+	uint32_t basic_features = regs[2];
+	/* SSE state is always enabled in 64-bit mode */
+	if (basic_features & (1 << 19)) {
+		features |= HASHX_CPU_SSE41;
+	}
+	if (max_leaf < 7) {
+		return features;
+	}
+	cpuid(7, 0, regs);
+	uint32_t ext_features = regs[1];
+	/* BMI2 doesn't need any OS support */
+	if (ext_features & (1 << 8)) {
+		features |= HASHX_CPU_BMI2;
+	}
+	/* OSXSAVE and AVX */
+	if ((basic_features & (1 << 27)) == 0 || (basic_features & (1 << 28)) == 0) {
+		return features;
+	}
+	uint64_t xcr0 = xgetbv();
+	if ((xcr0 & XCR0_AVX) == XCR0_AVX && (ext_features & (1 << 5))) {
+		features |= HASHX_CPU_AVX2;
+	}
+	if ((xcr0 & XCR0_AVX512) == XCR0_AVX512 &&
+		(ext_features & (1 << 16)) && (ext_features & (1 << 17))) {
+		features |= HASHX_CPU_AVX512;
+	}
+	return features;
+}
+#else
+static unsigned detect_features(void) {
+	return 0;
+}
+#endif
+
+static const struct {
+	const char* name;
+	hashx_cpu_feature feature;
+} feature_names[] = {
+	{ "avx2", HASHX_CPU_AVX2 },
+	{ "avx512", HASHX_CPU_AVX512 },
+	{ "bmi2", HASHX_CPU_BMI2 },
+	{ "sse41", HASHX_CPU_SSE41 },
+};
+
+/* Features listed in the environment variable, separated by commas.
+   Any other value, such as "none", disables all features. */
+static unsigned parse_features(const char* list) {
+	unsigned features = 0;
+	while (*list != '\0') {
+		size_t length = strcspn(list, ",");
+		for (size_t i = 0; i < sizeof(feature_names) / sizeof(feature_names[0]); ++i) {
+			if (strlen(feature_names[i].name) == length &&
+				strncmp(feature_names[i].name, list, length) == 0) {
+				features |= feature_names[i].feature;
+			}
+		}
+		list += length;
+		if (*list == ',') {
+			list++;
+		}
+	}
+	return features;
+}
+
+unsigned hashx_cpu_features(void) {
+	/* the result is always the same, so a race is harmless */
+	static int features = -1;
+	if (features < 0) {
+		unsigned detected = detect_features();
+		/* the override can only disable detected features */
+		const char* list = getenv(HASHX_CPU_ENV);
+		if (list != NULL) {
+			detected &= parse_features(list);
+		}
+		features = (int)detected;
+	}
+	return (unsigned)features;
+}
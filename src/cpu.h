@@ -0,0 +1,31 @@
+/* Copyright (c) 2020 tevador <tevador@gmail.com> */
+/* See LICENSE for licensing information */
+
+#ifndef CPU_H
+#define CPU_H
+
+#include <hashx.h>
+
+/* CPU features relevant for HashX */
+typedef enum hashx_cpu_feature {
+	HASHX_CPU_AVX2 = 1,
+	HASHX_CPU_AVX512 = 2, /* AVX-512F and AVX-512DQ */
+	HASHX_CPU_BMI2 = 4,
+	HASHX_CPU_SSE41 = 8,
+} hashx_cpu_feature;
+
+/* Environment variable that limits the features used by HashX, for
+   example HASHX_CPU=sse41,avx2,bmi2 or HASHX_CPU=none. */
+#define HASHX_CPU_ENV "HASHX_CPU"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+HASHX_PRIVATE unsigned hashx_cpu_features(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
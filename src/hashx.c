@@ -8,9 +8,12 @@
 #include <hashx.h>
 #include "blake2.h"
 #include "hashx_endian.h"
+#include "force_inline.h"
 #include "program.h"
 #include "context.h"
 #include "compiler.h"
+#include "cpu.h"
+#include "hashx_thread.h"
 
 #if HASHX_SIZE > 32
 #error HASHX_SIZE cannot be more than 32
@@ -22,60 +25,304 @@
 #define HASHX_INPUT_ARGS input, size
 #endif
 
-static int initialize_program(hashx_ctx* ctx, hashx_program* program, 
-	siphash_state keys[2]) {
-
-	if (!hashx_program_generate(&keys[0], program)) {
-		return 0;
-	}
+static void initialize_keys(hashx_ctx* ctx, const siphash_state* keys) {
 #ifndef HASHX_BLOCK_MODE
-	memcpy(&ctx->keys, &keys[1], 32);
+	memcpy(&ctx->keys, keys, 32);
 #else
-	memcpy(&ctx->params.salt, &keys[1], 32);
+	memcpy(&ctx->params.salt, keys, 32);
 #endif
 #ifndef NDEBUG
 	ctx->has_program = true;
 #endif
+}
+
+static int initialize_program(hashx_ctx* ctx, hashx_program* program, 
+	siphash_state keys[2]) {
+
+	if (!hashx_program_generate(&keys[0], program)) {
+		return 0;
+	}
+	initialize_keys(ctx, &keys[1]);
 	return 1;
 }
 
+void hashx_seed_keys(const void* seed, size_t size, siphash_state keys[2]) {
+	blake2b_state hash_state;
+	hashx_blake2b_init_param(&hash_state, &hashx_blake2_params);
+	hashx_blake2b_update(&hash_state, seed, size);
+	hashx_blake2b_final(&hash_state, keys, 2 * sizeof(siphash_state));
+}
+
 int hashx_make(hashx_ctx* ctx, const void* seed, size_t size) {
 	assert(ctx != NULL && ctx != HASHX_NOTSUPP);
 	assert(seed != NULL || size == 0);	
 	siphash_state keys[2];
-	blake2b_state hash_state;
-	hashx_blake2b_init_param(&hash_state, &hashx_blake2_params);
-	hashx_blake2b_update(&hash_state, seed, size);
-	hashx_blake2b_final(&hash_state, &keys, sizeof(keys));
+	hashx_seed_keys(seed, size, keys);
+	return hashx_make_keys(ctx, keys);
+}
+
+static int count_make(hashx_ctx* ctx, int result) {
+	hashx_atomic_add(result ? &ctx->stats.makes : &ctx->stats.rejected, 1);
+	if (!result) {
+		memset(&ctx->info, 0, sizeof(ctx->info));
+	}
+	return result;
+}
+
+hashx_prefix* hashx_prefix_alloc(void) {
+	hashx_prefix* prefix = malloc(sizeof(hashx_prefix));
+#ifndef NDEBUG
+	if (prefix != NULL) {
+		prefix->has_prefix = false;
+	}
+#endif
+	return prefix;
+}
+
+void hashx_prefix_set(hashx_prefix* prefix, const void* data, size_t size) {
+	assert(prefix != NULL);
+	assert(data != NULL || size == 0);
+	hashx_blake2b_init_param(&prefix->state, &hashx_blake2_params);
+	hashx_blake2b_update(&prefix->state, data, size);
+#ifndef NDEBUG
+	prefix->has_prefix = true;
+#endif
+}
+
+int hashx_make_prefix(hashx_ctx* ctx, const hashx_prefix* prefix,
+	const void* suffix, size_t size) {
+	assert(ctx != NULL && ctx != HASHX_NOTSUPP);
+	assert(prefix != NULL && prefix->has_prefix);
+	assert(suffix != NULL || size == 0);
+	/* BLAKE2b keeps the last block of input uncompressed until it's
+	   finalized, so a copy of the state can absorb more data. */
+	blake2b_state hash_state = prefix->state;
+	siphash_state keys[2];
+	hashx_blake2b_update(&hash_state, suffix, size);
+	hashx_blake2b_final(&hash_state, keys, 2 * sizeof(siphash_state));
+	return hashx_make_keys(ctx, keys);
+}
+
+void hashx_prefix_free(hashx_prefix* prefix) {
+	free(prefix);
+}
+
+int hashx_make_keys(hashx_ctx* ctx, siphash_state keys[2]) {
 	if (ctx->type & HASHX_COMPILED) {
 		hashx_program program;
 		if (!initialize_program(ctx, &program, keys)) {
-			return 0;
+			return count_make(ctx, 0);
 		}
-		hashx_compile(&program, ctx->code);
-		return 1;
+		hashx_compile(&program, ctx);
+		hashx_program_metrics(&program, &ctx->info);
+		return count_make(ctx, 1);
 	}
-	return initialize_program(ctx, ctx->program, keys);
+	if (!initialize_program(ctx, ctx->program, keys)) {
+		return count_make(ctx, 0);
+	}
+	hashx_program_decode(ctx->program, ctx->decoded);
+	hashx_program_metrics(ctx->program, &ctx->info);
+	return count_make(ctx, 1);
 }
 
-void hashx_exec(const hashx_ctx* ctx, HASHX_INPUT, void* output) {
+typedef struct make_job {
+	hashx_ctx* const* ctxs;
+	const void* const* seeds;
+	const size_t* seed_lens;
+	int* status;
+	size_t first, end, stride;
+	size_t made;
+} make_job;
+
+static hashx_thread_retval make_worker(void* args) {
+	make_job* job = args;
+	/* The instances are interleaved among the threads, so each one gets
+	   an equal share of the rare slow seeds on average. */
+	for (size_t i = job->first; i < job->end; i += job->stride) {
+		int ok = hashx_make(job->ctxs[i], job->seeds[i], job->seed_lens[i]);
+		if (job->status != NULL) {
+			job->status[i] = ok;
+		}
+		job->made += ok;
+	}
+	return HASHX_THREAD_SUCCESS;
+}
+
+size_t hashx_make_many(hashx_ctx* const ctxs[], const void* const seeds[],
+	const size_t seed_lens[], size_t n, int status_out[], unsigned threads) {
+
+	assert(n == 0 || (ctxs != NULL && seeds != NULL && seed_lens != NULL));
+	if (threads > n) {
+		threads = (unsigned)n;
+	}
+	if (threads < 1) {
+		threads = 1;
+	}
+	make_job single;
+	make_job* jobs = &single;
+	hashx_thread* handles = NULL;
+	if (threads > 1) {
+		jobs = malloc(threads * sizeof(make_job));
+		handles = malloc(threads * sizeof(hashx_thread));
+		if (jobs == NULL || handles == NULL) {
+			free(jobs);
+			free(handles);
+			jobs = &single;
+			handles = NULL;
+			threads = 1;
+		}
+	}
+	for (unsigned t = 0; t < threads; ++t) {
+		jobs[t].ctxs = ctxs;
+		jobs[t].seeds = seeds;
+		jobs[t].seed_lens = seed_lens;
+		jobs[t].status = status_out;
+		jobs[t].first = t;
+		jobs[t].end = n;
+		jobs[t].stride = threads;
+		jobs[t].made = 0;
+	}
+	unsigned spawned = 0;
+	for (unsigned t = 1; t < threads; ++t) {
+		handles[t] = hashx_thread_create(&make_worker, &jobs[t]);
+		if (!handles[t]) {
+			break;
+		}
+		spawned = t;
+	}
+	/* the calling thread takes the first share */
+	make_worker(&jobs[0]);
+	/* shares of threads that failed to start are done here */
+	for (unsigned t = spawned + 1; t < threads; ++t) {
+		make_worker(&jobs[t]);
+	}
+	size_t made = jobs[0].made;
+	for (unsigned t = 1; t < threads; ++t) {
+		if (t <= spawned) {
+			hashx_thread_join(handles[t]);
+		}
+		made += jobs[t].made;
+	}
+	if (jobs != &single) {
+		free(jobs);
+	}
+	free(handles);
+	return made;
+}
+
+hashx_func* hashx_func_alloc(void) {
+	hashx_func* func = malloc(sizeof(hashx_func));
+#ifndef NDEBUG
+	if (func != NULL) {
+		func->has_program = false;
+	}
+#endif
+	return func;
+}
+
+int hashx_generate(hashx_func* func, const void* seed, size_t size) {
+	assert(func != NULL);
+	assert(seed != NULL || size == 0);
+	siphash_state keys[2];
+	hashx_seed_keys(seed, size, keys);
+	if (!hashx_program_generate(&keys[0], &func->program)) {
+		return 0;
+	}
+	func->keys = keys[1];
+#ifndef NDEBUG
+	func->has_program = true;
+#endif
+	return 1;
+}
+
+void hashx_attach(hashx_ctx* ctx, const hashx_func* func) {
 	assert(ctx != NULL && ctx != HASHX_NOTSUPP);
-	assert(output != NULL);
-	assert(ctx->has_program);
-	uint64_t r[8];
+	assert(func != NULL && func->has_program);
+	initialize_keys(ctx, &func->keys);
+	if (ctx->type & HASHX_COMPILED) {
+		hashx_compile(&func->program, ctx);
+	}
+	else {
+		memcpy(ctx->program, &func->program, sizeof(hashx_program));
+		hashx_program_decode(ctx->program, ctx->decoded);
+	}
+	hashx_program_metrics(&func->program, &ctx->info);
+	count_make(ctx, 1);
+}
+
+void hashx_clone(hashx_ctx* ctx, const hashx_ctx* source) {
+	assert(ctx != NULL && ctx != HASHX_NOTSUPP);
+	assert(source != NULL && source != HASHX_NOTSUPP && source->has_program);
+	assert(ctx->type == source->type);
+	if (ctx == source) {
+		return;
+	}
 #ifndef HASHX_BLOCK_MODE
-	hashx_siphash24_ctr_state512(&ctx->keys, input, r);
+	ctx->keys = source->keys;
 #else
-	hashx_blake2b_4r(&ctx->params, input, size, r);
+	ctx->params = source->params;
 #endif
-
 	if (ctx->type & HASHX_COMPILED) {
-		ctx->func(r);
+		hashx_compiler_copy(ctx, source);
 	}
 	else {
-		hashx_program_execute(ctx->program, r);
+		memcpy(ctx->program, source->program, sizeof(hashx_program));
+		memcpy(ctx->decoded, source->decoded, sizeof(hashx_decoded_program));
 	}
+	ctx->info = source->info;
+#ifndef NDEBUG
+	ctx->has_program = true;
+#endif
+	count_make(ctx, 1);
+}
+
+void hashx_func_free(hashx_func* func) {
+	free(func);
+}
+
+/* number of nonces processed together by hashx_exec_batch */
+#define BATCH_LANES 8
 
+/* Returns the number of branches taken. */
+static FORCE_INLINE size_t execute_program(const hashx_ctx* ctx,
+	uint64_t r[][8], size_t lanes) {
+	if (ctx->type & HASHX_COMPILED) {
+		return ctx->func(r, lanes);
+	}
+	size_t i = 0;
+	size_t branches = 0;
+#ifdef HASHX_SIMD_X86
+	unsigned features = hashx_cpu_features();
+	if (features & HASHX_CPU_AVX512) {
+		for (; i + 8 <= lanes; i += 8) {
+			branches += hashx_program_execute_avx512(ctx->program, &r[i]);
+		}
+	}
+	if (features & HASHX_CPU_AVX2) {
+		for (; i + 4 <= lanes; i += 4) {
+			branches += hashx_program_execute_avx2(ctx->program, &r[i]);
+		}
+	}
+#endif
+	for (; i < lanes; ++i) {
+		branches += hashx_program_execute_decoded(ctx->decoded, r[i]);
+	}
+	return branches;
+}
+
+static FORCE_INLINE void count_execs(const hashx_ctx* ctx, size_t execs,
+	size_t branches) {
+	if (hashx_atomic_load_flag(&ctx->stats_enabled)) {
+		/* the counters are not part of the observable state */
+		hashx_stats* stats = (hashx_stats*)&ctx->stats;
+		hashx_atomic_add(&stats->execs, execs);
+		if (branches != 0) {
+			hashx_atomic_add(&stats->branches_taken, branches);
+		}
+	}
+}
+
+static FORCE_INLINE void finalize_hash(const hashx_ctx* ctx, uint64_t r[8]) {
 	/* Hash finalization to remove bias toward 0 caused by multiplications */
 #ifndef HASHX_BLOCK_MODE
 	r[0] += ctx->keys.v0;
@@ -96,8 +343,9 @@ void hashx_exec(const hashx_ctx* ctx, HASHX_INPUT, void* output) {
 	/* 1 SipRound per 4 registers is enough to pass SMHasher. */
 	SIPROUND(r[0], r[1], r[2], r[3]);
 	SIPROUND(r[4], r[5], r[6], r[7]);
+}
 
-	/* output */
+static FORCE_INLINE void store_hash(const uint64_t r[8], void* output) {
 #if HASHX_SIZE > 0
 	/* optimized output for hash sizes that are multiples of 8 */
 #if HASHX_SIZE % 8 == 0
@@ -132,3 +380,242 @@ void hashx_exec(const hashx_ctx* ctx, HASHX_INPUT, void* output) {
 #endif
 #endif
 }
+
+/* Calculates the hash of a single initial state. */
+static FORCE_INLINE void exec_state(const hashx_ctx* ctx, uint64_t r[1][8],
+	void* output) {
+	count_execs(ctx, 1, execute_program(ctx, r, 1));
+	finalize_hash(ctx, r[0]);
+	store_hash(r[0], output);
+}
+
+void hashx_exec(const hashx_ctx* ctx, HASHX_INPUT, void* output) {
+	assert(ctx != NULL && ctx != HASHX_NOTSUPP);
+	assert(output != NULL);
+	assert(ctx->has_program);
+	uint64_t r[8];
+#ifndef HASHX_BLOCK_MODE
+	if (ctx->hash != NULL) {
+		count_execs(ctx, 1, ctx->hash(input, output));
+		return;
+	}
+	hashx_siphash24_ctr_state512(&ctx->keys, input, r);
+#else
+	hashx_blake2b_4r(&ctx->params, input, size, r);
+#endif
+	exec_state(ctx, &r, output);
+}
+
+#ifndef HASHX_BLOCK_MODE
+static FORCE_INLINE void expand_states(const hashx_ctx* ctx, uint64_t nonce,
+	uint64_t r[][8], size_t lanes) {
+	size_t i = 0;
+#ifdef HASHX_SIMD_X86
+	unsigned features = hashx_cpu_features();
+	if (features & HASHX_CPU_AVX512) {
+		for (; i + 8 <= lanes; i += 8) {
+			hashx_siphash24_ctr_state512_avx512(&ctx->keys, nonce + i, &r[i]);
+		}
+	}
+	if (features & HASHX_CPU_AVX2) {
+		for (; i + 4 <= lanes; i += 4) {
+			hashx_siphash24_ctr_state512_avx2(&ctx->keys, nonce + i, &r[i]);
+		}
+	}
+#endif
+	for (; i < lanes; ++i) {
+		hashx_siphash24_ctr_state512(&ctx->keys, nonce + i, r[i]);
+	}
+}
+
+static FORCE_INLINE void finalize_hashes(const hashx_ctx* ctx,
+	uint64_t r[][8], size_t lanes) {
+	size_t i = 0;
+#ifdef HASHX_SIMD_X86
+	unsigned features = hashx_cpu_features();
+	if (features & HASHX_CPU_AVX512) {
+		for (; i + 8 <= lanes; i += 8) {
+			hashx_siphash_finalize_avx512(&ctx->keys, &r[i]);
+		}
+	}
+	if (features & HASHX_CPU_AVX2) {
+		for (; i + 4 <= lanes; i += 4) {
+			hashx_siphash_finalize_avx2(&ctx->keys, &r[i]);
+		}
+	}
+#endif
+	for (; i < lanes; ++i) {
+		finalize_hash(ctx, r[i]);
+	}
+}
+
+void hashx_exec_batch(const hashx_ctx* ctx, uint64_t first_nonce, size_t count,
+	void* output) {
+	assert(ctx != NULL && ctx != HASHX_NOTSUPP);
+	assert(output != NULL || count == 0);
+	assert(ctx->has_program);
+	uint8_t* out = (uint8_t*)output;
+	uint64_t r[2][BATCH_LANES][8];
+	size_t branches = 0;
+	size_t next = count < BATCH_LANES ? count : BATCH_LANES;
+	expand_states(ctx, first_nonce, r[0], next);
+	for (size_t i = 0, k = 0; i < count; k ^= 1) {
+		size_t lanes = next;
+		i += lanes;
+		next = count - i < BATCH_LANES ? count - i : BATCH_LANES;
+		/* Software pipelining: the initial states of the next group of
+		   nonces do not depend on the current group, so they can be
+		   computed in parallel with the program. */
+		expand_states(ctx, first_nonce + i, r[k ^ 1], next);
+		branches += execute_program(ctx, r[k], lanes);
+		finalize_hashes(ctx, r[k], lanes);
+		for (size_t j = 0; j < lanes; ++j) {
+			store_hash(r[k][j], out);
+			out += HASHX_SIZE;
+		}
+	}
+	count_execs(ctx, count, branches);
+}
+
+/* the value compared with the target by hashx_search */
+static FORCE_INLINE uint64_t hash_value(const uint64_t r[8]) {
+	uint64_t value = r[0] ^ r[4];
+#if HASHX_SIZE < 8
+	value &= (UINT64_C(1) << (8 * HASHX_SIZE)) - 1;
+#endif
+	return value;
+}
+
+size_t hashx_search(const hashx_ctx* ctx, uint64_t start, size_t count,
+	uint64_t target, uint64_t* results, size_t max_results) {
+	assert(ctx != NULL && ctx != HASHX_NOTSUPP);
+	assert(results != NULL || max_results == 0);
+	assert(ctx->has_program);
+	size_t found = 0;
+	if (max_results == 0) {
+		return 0;
+	}
+	uint64_t r[2][BATCH_LANES][8];
+	size_t branches = 0;
+	size_t next = count < BATCH_LANES ? count : BATCH_LANES;
+	expand_states(ctx, start, r[0], next);
+	for (size_t i = 0, k = 0; i < count; k ^= 1) {
+		size_t lanes = next;
+		uint64_t nonce = start + i;
+		i += lanes;
+		next = count - i < BATCH_LANES ? count - i : BATCH_LANES;
+		expand_states(ctx, start + i, r[k ^ 1], next);
+		branches += execute_program(ctx, r[k], lanes);
+		finalize_hashes(ctx, r[k], lanes);
+		for (size_t j = 0; j < lanes; ++j) {
+			if (hash_value(r[k][j]) < target) {
+				results[found++] = nonce + j;
+				if (found == max_results) {
+					count_execs(ctx, i, branches);
+					return found;
+				}
+			}
+		}
+	}
+	count_execs(ctx, count, branches);
+	return found;
+}
+#else
+void hashx_exec_many(const hashx_ctx* ctx, const void* const inputs[],
+	const size_t sizes[], size_t count, void* output) {
+	assert(ctx != NULL && ctx != HASHX_NOTSUPP);
+	assert((inputs != NULL && sizes != NULL && output != NULL) || count == 0);
+	assert(ctx->has_program);
+	uint8_t* out = (uint8_t*)output;
+	uint64_t r[2][BATCH_LANES][8];
+	size_t branches = 0;
+	size_t next = count < BATCH_LANES ? count : BATCH_LANES;
+	hashx_blake2b_4r_many(&ctx->params, inputs, sizes, r[0], next);
+	for (size_t i = 0, k = 0; i < count; k ^= 1) {
+		size_t lanes = next;
+		i += lanes;
+		next = count - i < BATCH_LANES ? count - i : BATCH_LANES;
+		/* the next group of inputs is absorbed while the program runs */
+		hashx_blake2b_4r_many(&ctx->params, &inputs[i], &sizes[i],
+			r[k ^ 1], next);
+		branches += execute_program(ctx, r[k], lanes);
+		for (size_t j = 0; j < lanes; ++j) {
+			finalize_hash(ctx, r[k][j]);
+			store_hash(r[k][j], out);
+			out += HASHX_SIZE;
+		}
+	}
+	count_execs(ctx, count, branches);
+}
+
+void hashx_exec_iov(const hashx_ctx* ctx, const hashx_iovec iov[],
+	size_t count, void* output) {
+	assert(ctx != NULL && ctx != HASHX_NOTSUPP);
+	assert(iov != NULL || count == 0);
+	assert(output != NULL);
+	assert(ctx->has_program);
+	uint64_t r[8];
+	hashx_blake2b_4r_iov(&ctx->params, iov, count, r);
+	exec_state(ctx, &r, output);
+}
+
+hashx_stream* hashx_stream_alloc(void) {
+	hashx_stream* stream = malloc(sizeof(hashx_stream));
+	if (stream != NULL) {
+		stream->ctx = NULL;
+	}
+	return stream;
+}
+
+void hashx_stream_init(hashx_stream* stream, const hashx_ctx* ctx) {
+	assert(stream != NULL);
+	assert(ctx != NULL && ctx != HASHX_NOTSUPP);
+	assert(ctx->has_program);
+	stream->ctx = ctx;
+	hashx_blake2b_init_param(&stream->state, &ctx->params);
+}
+
+void hashx_stream_update(hashx_stream* stream, const void* data,
+	size_t size) {
+	assert(stream != NULL && stream->ctx != NULL);
+	assert(data != NULL || size == 0);
+	hashx_blake2b_4r_update(&stream->state, data, size);
+}
+
+void hashx_stream_final(hashx_stream* stream, void* output) {
+	assert(stream != NULL && stream->ctx != NULL);
+	assert(output != NULL);
+	uint64_t r[8];
+	hashx_blake2b_4r_final(&stream->state, r);
+	exec_state(stream->ctx, &r, output);
+	stream->ctx = NULL;
+}
+
+void hashx_stream_free(hashx_stream* stream) {
+	free(stream);
+}
+#endif
+
+int hashx_query_program(const hashx_ctx* ctx, hashx_program_info* info) {
+	assert(ctx != NULL && ctx != HASHX_NOTSUPP);
+	assert(info != NULL);
+	if (ctx->info.code_size == 0) {
+		return 0;
+	}
+	*info = ctx->info;
+	return 1;
+}
+
+void hashx_stats_enable(hashx_ctx* ctx, int enable) {
+	assert(ctx != NULL && ctx != HASHX_NOTSUPP);
+	hashx_atomic_store_flag(&ctx->stats_enabled, enable != 0);
+}
+
+void hashx_query_stats(const hashx_ctx* ctx, hashx_stats* stats) {
+	assert(ctx != NULL && ctx != HASHX_NOTSUPP);
+	assert(stats != NULL);
+	stats->makes = hashx_atomic_load(&ctx->stats.makes);
+	stats->rejected = hashx_atomic_load(&ctx->stats.rejected);
+	stats->execs = hashx_atomic_load(&ctx->stats.execs);
+	stats->branches_taken = hashx_atomic_load(&ctx->stats.branches_taken);
+}
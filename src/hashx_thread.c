@@ -25,3 +25,36 @@ void hashx_thread_join(hashx_thread thread) {
 	pthread_join(thread, &retval);
 #endif
 }
+
+bool hashx_mutex_init(hashx_mutex* mutex) {
+#ifdef HASHX_WIN
+	InitializeCriticalSection(mutex);
+	return true;
+#else
+	return pthread_mutex_init(mutex, NULL) == 0;
+#endif
+}
+
+void hashx_mutex_lock(hashx_mutex* mutex) {
+#ifdef HASHX_WIN
+	EnterCriticalSection(mutex);
+#else
+	pthread_mutex_lock(mutex);
+#endif
+}
+
+void hashx_mutex_unlock(hashx_mutex* mutex) {
+#ifdef HASHX_WIN
+	LeaveCriticalSection(mutex);
+#else
+	pthread_mutex_unlock(mutex);
+#endif
+}
+
+void hashx_mutex_destroy(hashx_mutex* mutex) {
+#ifdef HASHX_WIN
+	DeleteCriticalSection(mutex);
+#else
+	pthread_mutex_destroy(mutex);
+#endif
+}
@@ -4,24 +4,72 @@
 #ifndef HASHX_THREAD_H
 #define HASHX_THREAD_H
 
+#include <stdbool.h>
+#include <stdint.h>
 #include <hashx.h>
+#include "force_inline.h"
 
 #ifdef HASHX_WIN
 #include <Windows.h>
 typedef HANDLE hashx_thread;
 typedef DWORD hashx_thread_retval;
+typedef CRITICAL_SECTION hashx_mutex;
 #define HASHX_THREAD_SUCCESS 0
 #else
 #include <pthread.h>
 typedef pthread_t hashx_thread;
 typedef void* hashx_thread_retval;
+typedef pthread_mutex_t hashx_mutex;
 #define HASHX_THREAD_SUCCESS NULL
 #endif
 
 typedef hashx_thread_retval hashx_thread_func(void* args);
 
-hashx_thread hashx_thread_create(hashx_thread_func* func, void* args);
+HASHX_PRIVATE hashx_thread hashx_thread_create(hashx_thread_func* func, void* args);
 
-void hashx_thread_join(hashx_thread thread);
+HASHX_PRIVATE void hashx_thread_join(hashx_thread thread);
+
+HASHX_PRIVATE bool hashx_mutex_init(hashx_mutex* mutex);
+
+HASHX_PRIVATE void hashx_mutex_lock(hashx_mutex* mutex);
+
+HASHX_PRIVATE void hashx_mutex_unlock(hashx_mutex* mutex);
+
+HASHX_PRIVATE void hashx_mutex_destroy(hashx_mutex* mutex);
+
+/* Relaxed atomic counters. They only need to be consistent on their own. */
+static FORCE_INLINE void hashx_atomic_add(uint64_t* counter, uint64_t value) {
+#ifdef HASHX_WIN
+	InterlockedExchangeAdd64((volatile LONG64*)counter, (LONG64)value);
+#else
+	__atomic_fetch_add(counter, value, __ATOMIC_RELAXED);
+#endif
+}
+
+static FORCE_INLINE uint64_t hashx_atomic_load(const uint64_t* counter) {
+#ifdef HASHX_WIN
+	return (uint64_t)InterlockedCompareExchange64(
+		(volatile LONG64*)counter, 0, 0);
+#else
+	return __atomic_load_n(counter, __ATOMIC_RELAXED);
+#endif
+}
+
+/* Relaxed atomic flag, read on every hash, so the load is a plain move. */
+static FORCE_INLINE bool hashx_atomic_load_flag(const uint32_t* flag) {
+#ifdef HASHX_WIN
+	return ReadNoFence((volatile LONG*)flag) != 0;
+#else
+	return __atomic_load_n(flag, __ATOMIC_RELAXED) != 0;
+#endif
+}
+
+static FORCE_INLINE void hashx_atomic_store_flag(uint32_t* flag, bool value) {
+#ifdef HASHX_WIN
+	WriteNoFence((volatile LONG*)flag, value);
+#else
+	__atomic_store_n(flag, value, __ATOMIC_RELAXED);
+#endif
+}
 
 #endif
@@ -20,12 +20,17 @@ typedef enum instr_type {
 	INSTR_BRANCH,    /* conditional branch */
 } instr_type;
 
+#define REGISTER_NONE 0xff
+
+/* Instructions are stored in a compact 8-byte form, so a whole program
+   fits comfortably in L1 next to the data. The operation parameter is
+   only needed during program generation and is not stored. */
 typedef struct instruction {
-	instr_type opcode;
-	int src;
-	int dst;
+	uint8_t opcode;  /* instr_type */
+	uint8_t src;     /* source register or REGISTER_NONE */
+	uint8_t dst;     /* destination register or REGISTER_NONE */
+	uint8_t unused;
 	uint32_t imm32;
-	uint32_t op_par;
 } instruction;
 
 #endif
@@ -0,0 +1,104 @@
+/* Copyright (c) 2020 tevador <tevador@gmail.com> */
+/* See LICENSE for licensing information */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+
+#include "perf_map.h"
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <unistd.h>
+
+/* one line of the map */
+#define LINE_MAX_SIZE 160
+
+int hashx_perf_map_level(void) {
+	/* the result is always the same, so a race is harmless */
+	static int level = -1;
+	if (level < 0) {
+		const char* value = getenv(HASHX_PERF_MAP_ENV);
+		level = value != NULL ? atoi(value) : 0;
+		if (level < 0) {
+			level = 0;
+		}
+	}
+	return level;
+}
+
+static size_t add_line(char* buffer, size_t pos, const uint8_t* start,
+	size_t size, const char* name) {
+	if (size == 0) {
+		return pos;
+	}
+	int length = snprintf(buffer + pos, LINE_MAX_SIZE, "%" PRIxPTR " %zx %s\n",
+		(uintptr_t)start, size, name);
+	if (length < 0) {
+		return pos;
+	}
+	return pos + (length < LINE_MAX_SIZE ? length : LINE_MAX_SIZE - 1);
+}
+
+void hashx_perf_map_add(const uint8_t* code, size_t size,
+	const char* name, const hashx_program* program, const uint32_t* offsets) {
+	size_t lines = 1;
+	if (offsets != NULL) {
+		lines += program->code_size + 1;
+	}
+	char* buffer = malloc(lines * LINE_MAX_SIZE);
+	if (buffer == NULL) {
+		return;
+	}
+	size_t pos = 0;
+	if (offsets == NULL) {
+		pos = add_line(buffer, pos, code, size, name);
+	}
+	else {
+		/* Symbols must not overlap, so the function symbol only covers
+		   the code before and after the program. */
+		uint32_t end = offsets[program->code_size];
+		pos = add_line(buffer, pos, code, offsets[0], name);
+		int target = 0;
+		for (size_t i = 0; i < program->code_size; ++i) {
+			const instruction* instr = &program->code[i];
+			char text[LINE_MAX_SIZE - 48];
+			char asm_text[96];
+			if (instr->opcode == INSTR_TARGET) {
+				target = (int)i;
+			}
+			if (offsets[i + 1] == offsets[i]) {
+				continue;
+			}
+			hashx_instr_asm_x86(instr, (int)i, target, " / ", asm_text,
+				sizeof(asm_text));
+			snprintf(text, sizeof(text), "%s[%zu] %s", name, i, asm_text);
+			pos = add_line(buffer, pos, code + offsets[i],
+				offsets[i + 1] - offsets[i], text);
+		}
+		pos = add_line(buffer, pos, code + end, size - end, name);
+	}
+	char path[64];
+	snprintf(path, sizeof(path), "/tmp/perf-%d.map", (int)getpid());
+	/* a single appending write keeps the records of concurrent
+	   compilations apart */
+	int fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+	if (fd >= 0) {
+		ssize_t written = write(fd, buffer, pos);
+		(void)written;
+		close(fd);
+	}
+	free(buffer);
+}
+
+#else
+
+int hashx_perf_map_level(void) {
+	return 0;
+}
+
+void hashx_perf_map_add(const uint8_t* code, size_t size,
+	const char* name, const hashx_program* program, const uint32_t* offsets) {
+}
+
+#endif
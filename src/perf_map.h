@@ -0,0 +1,39 @@
+/* Copyright (c) 2020 tevador <tevador@gmail.com> */
+/* See LICENSE for licensing information */
+
+#ifndef PERF_MAP_H
+#define PERF_MAP_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <hashx.h>
+#include "program.h"
+
+/* Environment variable that makes the JIT compilers describe the code
+   they emit in /tmp/perf-<pid>.map, so that profilers like perf can
+   attribute samples to it. HASHX_PERF_MAP=1 adds a symbol for each
+   compiled function, HASHX_PERF_MAP=2 also adds a symbol for each
+   HashX instruction. */
+#define HASHX_PERF_MAP_ENV "HASHX_PERF_MAP"
+
+#define HASHX_PERF_MAP_FUNCS 1
+#define HASHX_PERF_MAP_INSTRS 2
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* 0 if the perf map is disabled or not supported on this platform */
+HASHX_PRIVATE int hashx_perf_map_level(void);
+
+/* Add a compiled function of 'size' bytes at 'code'. If 'offsets' is not
+   NULL, offsets[i] is the offset of program instruction i from 'code' and
+   offsets[program->code_size] is the end of the last one. */
+HASHX_PRIVATE void hashx_perf_map_add(const uint8_t* code, size_t size,
+	const char* name, const hashx_program* program, const uint32_t* offsets);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
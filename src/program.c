@@ -9,6 +9,7 @@
 #include "program.h"
 #include "unreachable.h"
 #include "siphash_rng.h"
+#include "bitops.h"
 
 /* instructions are generated until this CPU cycle */
 #define TARGET_CYCLE 192
@@ -368,11 +369,11 @@ const static program_item* program_layout[] = {
 	&item_any,
 };
 
-static const instr_template* select_template(generator_ctx* ctx, instr_type last_instr, int attempt) {
-	const program_item* item = program_layout[ctx->sub_cycle % 36];
+static const instr_template* select_template(int sub_cycle, siphash_rng* gen, instr_type last_instr, int attempt) {
+	const program_item* item = program_layout[sub_cycle % 36];
 	const instr_template* tpl;
 	do {
-		int index = item->mask0 ? hashx_siphash_rng_u8(&ctx->gen) & (attempt > 0 ? item->mask1 : item->mask0) : 0;
+		int index = item->mask0 ? hashx_siphash_rng_u8(gen) & (attempt > 0 ? item->mask1 : item->mask0) : 0;
 		tpl = item->templates[index];
 	} while (!item->duplicates && tpl->group == last_instr);
 	return tpl;
@@ -392,7 +393,27 @@ static uint32_t branch_mask(siphash_rng* gen) {
 	return mask;
 }
 
-static void instr_from_template(const instr_template* tpl, siphash_rng* gen, instruction* instr) {
+/* instruction being generated */
+typedef struct generator_instr {
+	instr_type opcode;
+	int src;
+	int dst;
+	uint32_t imm32;
+	uint32_t op_par;
+} generator_instr;
+
+static instruction pack_instr(const generator_instr* instr) {
+	instruction packed = {
+		.opcode = (uint8_t)instr->opcode,
+		.src = (uint8_t)instr->src,
+		.dst = (uint8_t)instr->dst,
+		.unused = 0,
+		.imm32 = instr->imm32
+	};
+	return packed;
+}
+
+static void instr_from_template(const instr_template* tpl, siphash_rng* gen, generator_instr* instr) {
 	instr->opcode = tpl->type;
 	if (tpl->immediate_mask) {
 		if (tpl->immediate_mask == BRANCH_MASK) {
@@ -434,7 +455,7 @@ static bool select_register(int available_regs[8], int regs_count, siphash_rng*
 	return true;
 }
 
-static bool select_destination(const instr_template* tpl, instruction* instr, generator_ctx* ctx, int cycle) {
+static bool select_destination(const instr_template* tpl, generator_instr* instr, generator_ctx* ctx, int cycle) {
 	int available_regs[8];
 	int regs_count = 0;
 	/* Conditions for the destination register:
@@ -459,7 +480,7 @@ static bool select_destination(const instr_template* tpl, instruction* instr, ge
 	return select_register(available_regs, regs_count, &ctx->gen, &instr->dst);
 }
 
-static bool select_source(const instr_template* tpl, instruction* instr, generator_ctx* ctx, int cycle) {
+static bool select_source(const instr_template* tpl, generator_instr* instr, generator_ctx* ctx, int cycle) {
 	int available_regs[8];
 	int regs_count = 0;
 	/* all registers that are ready at the cycle */
@@ -542,7 +563,67 @@ static void print_registers(const generator_ctx* ctx) {
 	}
 }
 
-bool hashx_program_generate(const siphash_state* key, hashx_program* program) {
+static void program_init(hashx_program* program) {
+	program->code_size = 0;
+	program->x86_size = 0;
+	program->mul_count = 0;
+	program->wide_mul_count = 0;
+	program->branch_count = 0;
+	memset(program->asic_latencies, 0, sizeof(program->asic_latencies));
+}
+
+/* Append an instruction to the program and update the metrics. */
+static void program_append(hashx_program* program, const instr_template* tpl,
+	const generator_instr* instr) {
+	program->code[program->code_size++] = pack_instr(instr);
+	program->x86_size += tpl->x86_size;
+	program->mul_count += is_mul(instr->opcode);
+	program->wide_mul_count += is_wide_mul(instr->opcode);
+	program->branch_count += instr->opcode == INSTR_BRANCH;
+	/* ASIC latency assumes 1 cycle latency for all operations and
+	   unlimited parallelization. */
+	if (tpl->has_dst) {
+		int* latencies = program->asic_latencies;
+		int last_dst = latencies[instr->dst] + 1;
+		int lat_src = (tpl->has_src && instr->dst != instr->src)
+			? latencies[instr->src] + 1 : 0;
+		latencies[instr->dst] = MAX(last_dst, lat_src);
+	}
+}
+
+static void program_finish(hashx_program* program, int cpu_latency) {
+	program->cpu_latency = cpu_latency;
+	program->asic_latency = 0;
+	for (int i = 0; i < 8; ++i) {
+		program->asic_latency = MAX(program->asic_latency, program->asic_latencies[i]);
+	}
+}
+
+void hashx_program_metrics(const hashx_program* program, hashx_program_info* info) {
+	info->code_size = program->code_size;
+	info->x86_size = program->x86_size;
+	info->mul_count = program->mul_count;
+	info->wide_mul_count = program->wide_mul_count;
+	info->branch_count = program->branch_count;
+	info->cpu_latency = program->cpu_latency;
+	info->asic_latency = program->asic_latency;
+	info->ipc = program->code_size / (double)program->cpu_latency;
+}
+
+#ifdef HASHX_PROGRAM_STATS
+static void program_stats(hashx_program* program, unsigned counter,
+	const int cpu_latencies[8]) {
+	program->counter = counter;
+	for (int i = 0; i < 8; ++i) {
+		program->cpu_latencies[i] = cpu_latencies[i];
+	}
+	program->ipc = program->code_size / (double)program->cpu_latency;
+	program->branches_taken = 0;
+	memset(program->branches, 0, sizeof(program->branches));
+}
+#endif
+
+bool hashx_program_generate_ref(const siphash_state* key, hashx_program* program) {
 	generator_ctx ctx = {
 		.cycle = 0,
 		.sub_cycle = 0, /* 3 sub-cycles = 1 cycle */
@@ -557,25 +638,22 @@ bool hashx_program_generate(const siphash_state* key, hashx_program* program) {
 		ctx.registers[i].latency = 0;
 		ctx.registers[i].last_op_par = -1;
 	}
-	program->code_size = 0;
+	program_init(program);
 
 	int attempt = 0;
 	instr_type last_instr = -1;
-#ifdef HASHX_PROGRAM_STATS
-	program->x86_size = 0;
-#endif
 
 	while (program->code_size < HASHX_PROGRAM_MAX_SIZE) {
-		instruction* instr = &program->code[program->code_size];
+		generator_instr instr = { 0 };
 		TRACE_PRINT("CYCLE: %i/%i\n", ctx.sub_cycle, ctx.cycle);
 
 		/* select an instruction template */
-		const instr_template* tpl = select_template(&ctx, last_instr, attempt);
+		const instr_template* tpl = select_template(ctx.sub_cycle, &ctx.gen, last_instr, attempt);
 		last_instr = tpl->group;
 
 		TRACE_PRINT("Template: %s\n", tpl->x86_asm);
 
-		instr_from_template(tpl, &ctx.gen, instr);
+		instr_from_template(tpl, &ctx.gen, &instr);
 
 		/* calculate the earliest cycle when this instruction (all of its uOPs) can be scheduled for execution */
 		int scheduleCycle = schedule_instr(tpl, &ctx, false);
@@ -589,7 +667,7 @@ bool hashx_program_generate(const siphash_state* key, hashx_program* program) {
 
 		/* find a source register (if applicable) that will be ready when this instruction executes */
 		if (tpl->has_src) {
-			if (!select_source(tpl, instr, &ctx, scheduleCycle)) {
+			if (!select_source(tpl, &instr, &ctx, scheduleCycle)) {
 				TRACE_PRINT("; src STALL (attempt %i)\n", attempt);
 				if (attempt++ < MAX_RETRIES) {
 					continue;
@@ -604,12 +682,12 @@ bool hashx_program_generate(const siphash_state* key, hashx_program* program) {
 				attempt = 0;
 				continue;
 			}
-			TRACE_PRINT("; src = r%i\n", instr->src);
+			TRACE_PRINT("; src = r%i\n", instr.src);
 		}
 
 		/* find a destination register that will be ready when this instruction executes */
 		if (tpl->has_dst) {
-			if (!select_destination(tpl, instr, &ctx, scheduleCycle)) {
+			if (!select_destination(tpl, &instr, &ctx, scheduleCycle)) {
 				TRACE_PRINT("; dst STALL (attempt %i)\n", attempt);
 				if (attempt++ < MAX_RETRIES) {
 					continue;
@@ -624,7 +702,7 @@ bool hashx_program_generate(const siphash_state* key, hashx_program* program) {
 				attempt = 0;
 				continue;
 			}
-			TRACE_PRINT("; dst = r%i\n", instr->dst);
+			TRACE_PRINT("; dst = r%i\n", instr.dst);
 		}
 		attempt = 0;
 
@@ -642,57 +720,32 @@ bool hashx_program_generate(const siphash_state* key, hashx_program* program) {
 		}
 
 		if (tpl->has_dst) {
-			register_info* ri = &ctx.registers[instr->dst];
+			register_info* ri = &ctx.registers[instr.dst];
 			int retireCycle = scheduleCycle + tpl->latency;
 			ri->latency = retireCycle;
 			ri->last_op = tpl->group;
-			ri->last_op_par = instr->op_par;
+			ri->last_op_par = instr.op_par;
 			ctx.latency = MAX(retireCycle, ctx.latency);
 			TRACE_PRINT("; RETIRED at cycle %i\n", retireCycle);
 		}
 
-		program->code_size++;
-#ifdef HASHX_PROGRAM_STATS
-		program->x86_size += tpl->x86_size;
-#endif
+		program_append(program, tpl, &instr);
 
-		ctx.mul_count += is_mul(instr->opcode);
+		ctx.mul_count += is_mul(instr.opcode);
 
 		++ctx.sub_cycle;
 		ctx.sub_cycle += (tpl->uop2 != PORT_NONE);
 		ctx.cycle = ctx.sub_cycle / 3;
 	}
 
-#ifdef HASHX_PROGRAM_STATS
-	memset(program->asic_latencies, 0, sizeof(program->asic_latencies));
-
-	program->counter = ctx.gen.counter;
-	program->wide_mul_count = 0;
-	program->mul_count = ctx.mul_count;
+	program_finish(program, ctx.latency);
 
-	/* Calculate ASIC latency:
-	   Assumes 1 cycle latency for all operations and unlimited parallelization. */
-	for (int i = 0; i < program->code_size; ++i) {
-		instruction* instr = &program->code[i];
-		if (instr->dst < 0)
-			continue;
-		int last_dst = program->asic_latencies[instr->dst] + 1;
-		int lat_src = instr->dst != instr->src ? program->asic_latencies[instr->src] + 1 : 0;
-		program->asic_latencies[instr->dst] = MAX(last_dst, lat_src);
-		program->wide_mul_count += is_wide_mul(instr->opcode);
-	}
-
-	program->asic_latency = 0;
-	program->cpu_latency = 0;
+#ifdef HASHX_PROGRAM_STATS
+	int cpu_latencies[8];
 	for (int i = 0; i < 8; ++i) {
-		program->asic_latency = MAX(program->asic_latency, program->asic_latencies[i]);
-		program->cpu_latencies[i] = ctx.registers[i].latency;
-		program->cpu_latency = MAX(program->cpu_latency, program->cpu_latencies[i]);
+		cpu_latencies[i] = ctx.registers[i].latency;
 	}
-
-	program->ipc = program->code_size / (double)program->cpu_latency;
-	program->branch_count = 0;
-	memset(program->branches, 0, sizeof(program->branches));
+	program_stats(program, ctx.gen.counter, cpu_latencies);
 
 	if (TRACE) {
 		printf("; ALU port utilization:\n");
@@ -715,57 +768,312 @@ bool hashx_program_generate(const siphash_state* key, hashx_program* program) {
 		(ctx.latency == REQUIREMENT_LATENCY - 1); /* cycles are numbered from 0 */
 }
 
+/*
+ * Fast generator. It makes the same decisions in the same order as the
+ * reference generator above, so it consumes the same random numbers and
+ * produces identical programs, but:
+ * - port occupancy is kept as a bitmask of cycles for each port, so the
+ *   earliest cycle with a free port is found with a few bit operations
+ *   instead of scanning the port map cycle by cycle,
+ * - each instruction is scheduled only once (the port map doesn't change
+ *   between the two passes of the reference generator),
+ * - register readiness and history are checked with register masks.
+ */
+
+#define PORT_WORDS ((PORT_MAP_SIZE + 63) / 64)
+#define REG_BIT(i) (1U << (i))
+
+typedef struct fast_generator_ctx {
+	int cycle;
+	int sub_cycle;
+	int mul_count;
+	bool chain_mul;
+	int latency;
+	siphash_rng gen;
+	int reg_latency[8];
+	uint32_t last_op_par[8];
+	/* registers by the group of the last op applied to them */
+	uint32_t group_regs[INSTR_BRANCH + 1];
+	int last_op[8];
+	/* bit c of busy[p] is set if port p is used at cycle c; the ports are
+	   P0, P1, P5 and cycles past the end of the port map are always busy */
+	uint64_t busy[NUM_PORTS][PORT_WORDS];
+} fast_generator_ctx;
+
+/* The first cycle >= cycle when any of the ports is free. If all is true,
+   all of the ports must be free in the same cycle. Returns -1 if there is
+   no such cycle. */
+static int find_free_cycle(const fast_generator_ctx* ctx, execution_port ports,
+	bool all, int cycle) {
+	for (int w = cycle / 64; w < PORT_WORDS; ++w) {
+		uint64_t free_any = 0;
+		uint64_t free_all = UINT64_MAX;
+		for (int p = 0; p < NUM_PORTS; ++p) {
+			if (ports & (1 << p)) {
+				free_any |= ~ctx->busy[p][w];
+				free_all &= ~ctx->busy[p][w];
+			}
+		}
+		uint64_t free = all ? free_all : free_any;
+		if (w == cycle / 64) {
+			free &= UINT64_MAX << (cycle % 64);
+		}
+		if (free != 0) {
+			return w * 64 + hashx_ctz64(free);
+		}
+	}
+	return -1;
+}
+
+static void commit_uop(fast_generator_ctx* ctx, execution_port uop, int cycle) {
+	/* the first free port in the same order as schedule_uop: P5 -> P0 -> P1 */
+	static const int first_port[8] = { -1, 0, 1, 0, 2, 2, 2, 2 };
+	int w = cycle / 64;
+	int b = cycle % 64;
+	unsigned free = 0;
+	for (int p = 0; p < NUM_PORTS; ++p) {
+		free |= (unsigned)(~ctx->busy[p][w] >> b & 1) << p;
+	}
+	int port = first_port[free & uop];
+	if (port >= 0) {
+		ctx->busy[port][w] |= 1ULL << b;
+	}
+}
+
+static int fast_schedule_instr(const instr_template* tpl, const fast_generator_ctx* ctx) {
+	if (tpl->uop2 == PORT_NONE || tpl->uop1 == tpl->uop2) {
+		return find_free_cycle(ctx, tpl->uop1, false, ctx->cycle);
+	}
+	/* The only instructions with 2 different uOPs are the wide
+	   multiplications, which use one port for each uOP. Both ports
+	   must be free in the same cycle. */
+	return find_free_cycle(ctx, tpl->uop1 | tpl->uop2, true, ctx->cycle);
+}
+
+static void fast_commit_instr(const instr_template* tpl, fast_generator_ctx* ctx, int cycle) {
+	commit_uop(ctx, tpl->uop1, cycle);
+	if (tpl->uop2 != PORT_NONE) {
+		/* if both uOPs compete for the same ports, the reference generator
+		   commits the 2nd uOP to the next free cycle */
+		int cycle2 = find_free_cycle(ctx, tpl->uop2, false, cycle);
+		if (cycle2 >= 0) {
+			commit_uop(ctx, tpl->uop2, cycle2);
+		}
+	}
+}
+
+static uint32_t ready_regs(const fast_generator_ctx* ctx, int cycle) {
+	uint32_t mask = 0;
+	for (int i = 0; i < 8; ++i) {
+		mask |= (ctx->reg_latency[i] <= cycle) << i;
+	}
+	return mask;
+}
+
+static bool select_register_mask(uint32_t available, siphash_rng* gen, int* reg_out) {
+	/* branchless conversion to the list used by select_register */
+	int available_regs[8];
+	int regs_count = 0;
+	for (int i = 0; i < 8; ++i) {
+		available_regs[regs_count] = i;
+		regs_count += (available >> i) & 1;
+	}
+	return select_register(available_regs, regs_count, gen, reg_out);
+}
+
+static bool fast_select_source(const instr_template* tpl, generator_instr* instr, fast_generator_ctx* ctx, uint32_t ready) {
+	if (instr->opcode == INSTR_ADD_RS && hashx_popcount32(ready) == 2 &&
+		(ready & REG_BIT(REGISTER_NEEDS_DISPLACEMENT))) {
+		instr->op_par = instr->src = REGISTER_NEEDS_DISPLACEMENT;
+		return true;
+	}
+	if (select_register_mask(ready, &ctx->gen, &instr->src)) {
+		if (tpl->op_par_src)
+			instr->op_par = instr->src;
+		return true;
+	}
+	return false;
+}
+
+static bool fast_select_destination(const instr_template* tpl, generator_instr* instr, fast_generator_ctx* ctx, uint32_t ready) {
+	/* same conditions as select_destination */
+	uint32_t available = ready;
+	if (tpl->distinct_dst && instr->src >= 0) {
+		available &= ~REG_BIT(instr->src);
+	}
+	if (!ctx->chain_mul && tpl->group == INSTR_MUL_R) {
+		available &= ~ctx->group_regs[INSTR_MUL_R];
+	}
+	for (uint32_t same = available & ctx->group_regs[tpl->group]; same != 0; same &= same - 1) {
+		int i = hashx_ctz64(same);
+		if (ctx->last_op_par[i] == instr->op_par) {
+			available &= ~REG_BIT(i);
+		}
+	}
+	if (instr->opcode == INSTR_ADD_RS) {
+		available &= ~REG_BIT(REGISTER_NEEDS_DISPLACEMENT);
+	}
+	return select_register_mask(available, &ctx->gen, &instr->dst);
+}
+
+bool hashx_program_generate(const siphash_state* key, hashx_program* program) {
+	fast_generator_ctx ctx = {
+		.cycle = 0,
+		.sub_cycle = 0, /* 3 sub-cycles = 1 cycle */
+		.mul_count = 0,
+		.chain_mul = false,
+		.latency = 0,
+		.reg_latency = { 0 },
+		.group_regs = { 0 },
+		.busy = { { 0 } }
+	};
+	hashx_siphash_rng_init(&ctx.gen, key);
+	for (int i = 0; i < 8; ++i) {
+		ctx.last_op[i] = -1;
+		ctx.last_op_par[i] = UINT32_MAX;
+	}
+	for (int p = 0; p < NUM_PORTS; ++p) {
+		ctx.busy[p][PORT_WORDS - 1] = UINT64_MAX << (PORT_MAP_SIZE % 64);
+	}
+	program_init(program);
+
+	int attempt = 0;
+	instr_type last_instr = -1;
+
+	while (program->code_size < HASHX_PROGRAM_MAX_SIZE) {
+		generator_instr instr = { 0 };
+
+		const instr_template* tpl = select_template(ctx.sub_cycle, &ctx.gen, last_instr, attempt);
+		last_instr = tpl->group;
+
+		instr_from_template(tpl, &ctx.gen, &instr);
+
+		int scheduleCycle = fast_schedule_instr(tpl, &ctx);
+		if (scheduleCycle < 0) {
+			break;
+		}
+
+		ctx.chain_mul = attempt > 0;
+
+		uint32_t ready = ready_regs(&ctx, scheduleCycle);
+
+		if (tpl->has_src && !fast_select_source(tpl, &instr, &ctx, ready)) {
+			if (attempt++ < MAX_RETRIES) {
+				continue;
+			}
+			ctx.sub_cycle += 3;
+			ctx.cycle = ctx.sub_cycle / 3;
+			attempt = 0;
+			continue;
+		}
+
+		if (tpl->has_dst && !fast_select_destination(tpl, &instr, &ctx, ready)) {
+			if (attempt++ < MAX_RETRIES) {
+				continue;
+			}
+			ctx.sub_cycle += 3;
+			ctx.cycle = ctx.sub_cycle / 3;
+			attempt = 0;
+			continue;
+		}
+		attempt = 0;
+
+		fast_commit_instr(tpl, &ctx, scheduleCycle);
+
+		/* terminating condition */
+		if (scheduleCycle >= TARGET_CYCLE) {
+			break;
+		}
+
+		if (tpl->has_dst) {
+			int dst = instr.dst;
+			int retireCycle = scheduleCycle + tpl->latency;
+			ctx.reg_latency[dst] = retireCycle;
+			if (ctx.last_op[dst] >= 0) {
+				ctx.group_regs[ctx.last_op[dst]] &= ~REG_BIT(dst);
+			}
+			ctx.group_regs[tpl->group] |= REG_BIT(dst);
+			ctx.last_op[dst] = tpl->group;
+			ctx.last_op_par[dst] = instr.op_par;
+			ctx.latency = MAX(retireCycle, ctx.latency);
+		}
+
+		program_append(program, tpl, &instr);
+
+		ctx.mul_count += is_mul(instr.opcode);
+
+		++ctx.sub_cycle;
+		ctx.sub_cycle += (tpl->uop2 != PORT_NONE);
+		ctx.cycle = ctx.sub_cycle / 3;
+	}
+
+	program_finish(program, ctx.latency);
+
+#ifdef HASHX_PROGRAM_STATS
+	program_stats(program, ctx.gen.counter, ctx.reg_latency);
+#endif
+
+	return
+		(program->code_size == REQUIREMENT_SIZE) &
+		(ctx.mul_count == REQUIREMENT_MUL_COUNT) &
+		(ctx.latency == REQUIREMENT_LATENCY - 1);
+}
+
 static const char* x86_reg_map[] = { "r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15" };
 
+void hashx_instr_asm_x86(const instruction* instr, int index, int target,
+	const char* sep, char* buffer, size_t size) {
+	const char* dst = x86_reg_map[instr->dst];
+	const char* src = x86_reg_map[instr->src];
+	switch (instr->opcode)
+	{
+	case INSTR_SUB_R:
+		snprintf(buffer, size, "sub %s, %s", dst, src);
+		break;
+	case INSTR_XOR_R:
+		snprintf(buffer, size, "xor %s, %s", dst, src);
+		break;
+	case INSTR_ADD_RS:
+		snprintf(buffer, size, "lea %s, [%s+%s*%u]", dst, dst, src, 1 << instr->imm32);
+		break;
+	case INSTR_MUL_R:
+		snprintf(buffer, size, "imul %s, %s", dst, src);
+		break;
+	case INSTR_ROR_C:
+		snprintf(buffer, size, "ror %s, %u", dst, instr->imm32);
+		break;
+	case INSTR_ADD_C:
+		snprintf(buffer, size, "add %s, %i", dst, instr->imm32);
+		break;
+	case INSTR_XOR_C:
+		snprintf(buffer, size, "xor %s, %i", dst, instr->imm32);
+		break;
+	case INSTR_UMULH_R:
+		snprintf(buffer, size, "mov rax, %s%smul %s%smov %s, rdx", dst, sep, src, sep, dst);
+		break;
+	case INSTR_SMULH_R:
+		snprintf(buffer, size, "mov rax, %s%simul %s%smov %s, rdx", dst, sep, src, sep, dst);
+		break;
+	case INSTR_TARGET:
+		snprintf(buffer, size, "test edi, edi%starget_%i: cmovz esi, edi", sep, index);
+		break;
+	case INSTR_BRANCH:
+		snprintf(buffer, size, "or edx, esi%stest edx, %i%sjz target_%i", sep, instr->imm32, sep, target);
+		break;
+	default:
+		UNREACHABLE;
+	}
+}
+
 void hashx_program_asm_x86(const hashx_program* program) {
 	int target = 0;
 	for (unsigned i = 0; i < program->code_size; ++i) {
 		const instruction* instr = &program->code[i];
-		switch (instr->opcode)
-		{
-		case INSTR_SUB_R:
-			printf("sub %s, %s\n", x86_reg_map[instr->dst], x86_reg_map[instr->src]);
-			break;
-		case INSTR_XOR_R:
-			printf("xor %s, %s\n", x86_reg_map[instr->dst], x86_reg_map[instr->src]);
-			break;
-		case INSTR_ADD_RS:
-			printf("lea %s, [%s+%s*%u]\n", x86_reg_map[instr->dst], x86_reg_map[instr->dst], x86_reg_map[instr->src], 1 << instr->imm32);
-			break;
-		case INSTR_MUL_R:
-			printf("imul %s, %s\n", x86_reg_map[instr->dst], x86_reg_map[instr->src]);
-			break;
-		case INSTR_ROR_C:
-			printf("ror %s, %u\n", x86_reg_map[instr->dst], instr->imm32);
-			break;
-		case INSTR_ADD_C:
-			printf("add %s, %i\n", x86_reg_map[instr->dst], instr->imm32);
-			break;
-		case INSTR_XOR_C:
-			printf("xor %s, %i\n", x86_reg_map[instr->dst], instr->imm32);
-			break;
-		case INSTR_UMULH_R:
-			printf("mov rax, %s\n", x86_reg_map[instr->dst]);
-			printf("mul %s\n", x86_reg_map[instr->src]);
-			printf("mov %s, rdx\n", x86_reg_map[instr->dst]);
-			break;
-		case INSTR_SMULH_R:
-			printf("mov rax, %s\n", x86_reg_map[instr->dst]);
-			printf("imul %s\n", x86_reg_map[instr->src]);
-			printf("mov %s, rdx\n", x86_reg_map[instr->dst]);
-			break;
-		case INSTR_TARGET:
-			printf("test edi, edi\n");
-			printf("target_%i: cmovz esi, edi\n", i);
+		char line[96];
+		if (instr->opcode == INSTR_TARGET) {
 			target = i;
-			break;
-		case INSTR_BRANCH:
-			printf("or edx, esi\n");
-			printf("test edx, %i\n", instr->imm32);
-			printf("jz target_%i\n", target);
-			break;
-		default:
-			UNREACHABLE;
 		}
+		hashx_instr_asm_x86(instr, i, target, "\n", line, sizeof(line));
+		printf("%s\n", line);
 	}
 }
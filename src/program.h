@@ -16,31 +16,87 @@
 typedef struct hashx_program {
 	instruction code[HASHX_PROGRAM_MAX_SIZE];
 	size_t code_size;
-#ifdef HASHX_PROGRAM_STATS
-	unsigned counter;
-	double ipc;
+	/* metrics recorded by the generator, see hashx_program_info */
 	int x86_size;
 	int cpu_latency;
 	int asic_latency;
 	int mul_count;
 	int wide_mul_count;
-	int cpu_latencies[8];
-	int asic_latencies[8];
 	int branch_count;
+	int asic_latencies[8];
+#ifdef HASHX_PROGRAM_STATS
+	unsigned counter;
+	double ipc;
+	int cpu_latencies[8];
+	int branches_taken;
 	int branches[16];
 #endif
 } hashx_program;
 
+/* Direct threading needs the labels-as-values extension. */
+#if defined(__GNUC__) || defined(__clang__)
+#define HASHX_THREADED_INTERPRETER
+#endif
+
+/* Pre-decoded instruction of the threaded interpreter. TARGET instructions
+   are removed and branches point directly to the next instruction to be
+   executed. */
+typedef struct decoded_instr {
+#ifdef HASHX_THREADED_INTERPRETER
+	const void* handler;
+#else
+	uint32_t opcode;
+#endif
+	uint8_t dst;
+	uint8_t src;
+	uint16_t target;
+	uint32_t imm32;
+} decoded_instr;
+
+/* the last instruction terminates the program */
+typedef struct hashx_decoded_program {
+	decoded_instr code[HASHX_PROGRAM_MAX_SIZE + 1];
+} hashx_decoded_program;
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 HASHX_PRIVATE bool hashx_program_generate(const siphash_state* key, hashx_program* program);
 
+/* Reference implementation of hashx_program_generate. It is slower, but
+   easier to follow. Both functions generate identical programs. */
+HASHX_PRIVATE bool hashx_program_generate_ref(const siphash_state* key, hashx_program* program);
+
+/* Calculate the metrics of a generated program. */
+HASHX_PRIVATE void hashx_program_metrics(const hashx_program* program, hashx_program_info* info);
+
 HASHX_PRIVATE void hashx_program_execute(const hashx_program* program, uint64_t r[8]);
 
+/* Translate a program for hashx_program_execute_decoded. */
+HASHX_PRIVATE void hashx_program_decode(const hashx_program* program, hashx_decoded_program* decoded);
+
+/* Same as hashx_program_execute, but the instructions are dispatched
+   directly from the pre-decoded form. Returns the number of branches
+   taken. */
+HASHX_PRIVATE int hashx_program_execute_decoded(const hashx_decoded_program* decoded, uint64_t r[8]);
+
+/* Execute the program for 4 register files in parallel (AVX2). Returns
+   the number of branches taken. */
+HASHX_PRIVATE int hashx_program_execute_avx2(const hashx_program* program, uint64_t r[][8]);
+
+/* Execute the program for 8 register files in parallel (AVX-512).
+   Returns the number of branches taken. */
+HASHX_PRIVATE int hashx_program_execute_avx512(const hashx_program* program, uint64_t r[][8]);
+
 HASHX_PRIVATE void hashx_program_asm_x86(const hashx_program* program);
 
+/* Format one instruction like hashx_program_asm_x86. Multiple x86
+   instructions are separated by 'sep'. 'target' is the index of the
+   TARGET instruction of a branch. */
+HASHX_PRIVATE void hashx_instr_asm_x86(const instruction* instr, int index,
+	int target, const char* sep, char* buffer, size_t size);
+
 #ifdef __cplusplus
 }
 #endif
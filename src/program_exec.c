@@ -139,7 +139,7 @@ void hashx_program_execute(const hashx_program* program, uint64_t r[8]) {
 				i = target;
 				branch_enable = false;
 #ifdef HASHX_PROGRAM_STATS
-				((hashx_program*)program)->branch_count++;
+				((hashx_program*)program)->branches_taken++;
 				((hashx_program*)program)->branches[branch_idx]++;
 #endif
 			}
@@ -150,3 +150,179 @@ void hashx_program_execute(const hashx_program* program, uint64_t r[8]) {
 		}
 	}
 }
+
+/* The opcode of the instruction that terminates a decoded program. */
+#define INSTR_END (INSTR_BRANCH + 1)
+
+#ifdef HASHX_THREADED_INTERPRETER
+/* Each handler ends with its own indirect jump to the next handler, so
+   the dispatch branches are predicted separately for each instruction
+   type. When called with code == NULL, the function only returns
+   the handler table for hashx_program_decode. */
+static int execute_threaded(const decoded_instr* code, uint64_t r[8],
+	const void* const** handlers_out) {
+	static const void* const handlers[] = {
+		[INSTR_UMULH_R] = &&umulh_r,
+		[INSTR_SMULH_R] = &&smulh_r,
+		[INSTR_MUL_R] = &&mul_r,
+		[INSTR_SUB_R] = &&sub_r,
+		[INSTR_XOR_R] = &&xor_r,
+		[INSTR_ADD_RS] = &&add_rs,
+		[INSTR_ROR_C] = &&ror_c,
+		[INSTR_ADD_C] = &&add_c,
+		[INSTR_XOR_C] = &&xor_c,
+		[INSTR_TARGET] = NULL,
+		[INSTR_BRANCH] = &&branch,
+		[INSTR_END] = &&end,
+	};
+	if (code == NULL) {
+		*handlers_out = handlers;
+		return 0;
+	}
+	const decoded_instr* instr = code;
+	bool branch_enable = true;
+	uint32_t result = 0;
+
+#define DISPATCH goto *instr->handler
+#define NEXT ++instr; DISPATCH
+
+	DISPATCH;
+umulh_r:
+	result = r[instr->dst] = umulh(r[instr->dst], r[instr->src]);
+	NEXT;
+smulh_r:
+	result = r[instr->dst] = smulh(r[instr->dst], r[instr->src]);
+	NEXT;
+mul_r:
+	r[instr->dst] *= r[instr->src];
+	NEXT;
+sub_r:
+	r[instr->dst] -= r[instr->src];
+	NEXT;
+xor_r:
+	r[instr->dst] ^= r[instr->src];
+	NEXT;
+add_rs:
+	r[instr->dst] += r[instr->src] << instr->imm32;
+	NEXT;
+ror_c:
+	r[instr->dst] = rotr64(r[instr->dst], instr->imm32);
+	NEXT;
+add_c:
+	r[instr->dst] += sign_extend_2s_compl(instr->imm32);
+	NEXT;
+xor_c:
+	r[instr->dst] ^= sign_extend_2s_compl(instr->imm32);
+	NEXT;
+branch:
+	if (branch_enable && (result & instr->imm32) == 0) {
+		branch_enable = false;
+		instr = &code[instr->target];
+		DISPATCH;
+	}
+	NEXT;
+end:
+	return !branch_enable;
+
+#undef NEXT
+#undef DISPATCH
+}
+#endif
+
+void hashx_program_decode(const hashx_program* program,
+	hashx_decoded_program* decoded) {
+#ifdef HASHX_THREADED_INTERPRETER
+	const void* const* handlers;
+	execute_threaded(NULL, NULL, &handlers);
+#endif
+	/* position of each instruction in the decoded program */
+	uint16_t index[HASHX_PROGRAM_MAX_SIZE + 1];
+	int target = 0;
+	int count = 0;
+	for (int i = 0; i < program->code_size; ++i) {
+		index[i] = count;
+		count += program->code[i].opcode != INSTR_TARGET;
+	}
+	index[program->code_size] = count;
+	count = 0;
+	for (int i = 0; i < program->code_size; ++i) {
+		const instruction* instr = &program->code[i];
+		if (instr->opcode == INSTR_TARGET) {
+			target = i;
+			continue;
+		}
+		decoded_instr* out = &decoded->code[count++];
+#ifdef HASHX_THREADED_INTERPRETER
+		out->handler = handlers[instr->opcode];
+#else
+		out->opcode = instr->opcode;
+#endif
+		out->dst = instr->dst;
+		out->src = instr->src;
+		/* hashx_program_execute continues after the last target */
+		out->target = index[target + 1];
+		out->imm32 = instr->imm32;
+	}
+	decoded_instr* end = &decoded->code[count];
+#ifdef HASHX_THREADED_INTERPRETER
+	end->handler = handlers[INSTR_END];
+#else
+	end->opcode = INSTR_END;
+#endif
+	end->dst = end->src = 0;
+	end->target = 0;
+	end->imm32 = 0;
+}
+
+int hashx_program_execute_decoded(const hashx_decoded_program* decoded,
+	uint64_t r[8]) {
+#ifdef HASHX_THREADED_INTERPRETER
+	return execute_threaded(decoded->code, r, NULL);
+#else
+	bool branch_enable = true;
+	uint32_t result = 0;
+	for (int i = 0;; ++i) {
+		const decoded_instr* instr = &decoded->code[i];
+		switch (instr->opcode)
+		{
+		case INSTR_UMULH_R:
+			result = r[instr->dst] = umulh(r[instr->dst], r[instr->src]);
+			break;
+		case INSTR_SMULH_R:
+			result = r[instr->dst] = smulh(r[instr->dst], r[instr->src]);
+			break;
+		case INSTR_MUL_R:
+			r[instr->dst] *= r[instr->src];
+			break;
+		case INSTR_SUB_R:
+			r[instr->dst] -= r[instr->src];
+			break;
+		case INSTR_XOR_R:
+			r[instr->dst] ^= r[instr->src];
+			break;
+		case INSTR_ADD_RS:
+			r[instr->dst] += r[instr->src] << instr->imm32;
+			break;
+		case INSTR_ROR_C:
+			r[instr->dst] = rotr64(r[instr->dst], instr->imm32);
+			break;
+		case INSTR_ADD_C:
+			r[instr->dst] += sign_extend_2s_compl(instr->imm32);
+			break;
+		case INSTR_XOR_C:
+			r[instr->dst] ^= sign_extend_2s_compl(instr->imm32);
+			break;
+		case INSTR_BRANCH:
+			if (branch_enable && (result & instr->imm32) == 0) {
+				branch_enable = false;
+				i = instr->target - 1;
+			}
+			break;
+		case INSTR_END:
+			return !branch_enable;
+		default:
+			UNREACHABLE;
+		}
+	}
+#endif
+}
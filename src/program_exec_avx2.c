@@ -0,0 +1,162 @@
+/* Copyright (c) 2020 tevador <tevador@gmail.com> */
+/* See LICENSE for licensing information */
+
+/* Interpreter that executes a program for 4 inputs in parallel using AVX2.
+   Each vector register holds the values of one HashX register for all
+   4 lanes. */
+
+#include "program.h"
+#include "force_inline.h"
+#include "unreachable.h"
+#include "bitops.h"
+
+#if defined(HASHX_SIMD_X86) && defined(__AVX2__)
+
+#include <immintrin.h>
+
+#define LANES 4
+#define LANE_MASK 0xf
+
+/* high 64 bits of the 128-bit unsigned product from 32x32 partial products */
+static FORCE_INLINE __m256i umulh(__m256i a, __m256i b) {
+	__m256i lo32 = _mm256_set1_epi64x(0xffffffff);
+	__m256i a_hi = _mm256_srli_epi64(a, 32);
+	__m256i b_hi = _mm256_srli_epi64(b, 32);
+	__m256i ll = _mm256_mul_epu32(a, b);
+	__m256i lh = _mm256_mul_epu32(a, b_hi);
+	__m256i hl = _mm256_mul_epu32(a_hi, b);
+	__m256i hh = _mm256_mul_epu32(a_hi, b_hi);
+	__m256i t = _mm256_add_epi64(hl, _mm256_srli_epi64(ll, 32));
+	__m256i u = _mm256_add_epi64(lh, _mm256_and_si256(t, lo32));
+	hh = _mm256_add_epi64(hh, _mm256_srli_epi64(t, 32));
+	return _mm256_add_epi64(hh, _mm256_srli_epi64(u, 32));
+}
+
+static FORCE_INLINE __m256i smulh(__m256i a, __m256i b) {
+	__m256i zero = _mm256_setzero_si256();
+	__m256i hi = umulh(a, b);
+	__m256i a_neg = _mm256_cmpgt_epi64(zero, a);
+	__m256i b_neg = _mm256_cmpgt_epi64(zero, b);
+	hi = _mm256_sub_epi64(hi, _mm256_and_si256(a_neg, b));
+	return _mm256_sub_epi64(hi, _mm256_and_si256(b_neg, a));
+}
+
+/* low 64 bits of the product */
+static FORCE_INLINE __m256i mul(__m256i a, __m256i b) {
+	__m256i ll = _mm256_mul_epu32(a, b);
+	__m256i lh = _mm256_mul_epu32(a, _mm256_srli_epi64(b, 32));
+	__m256i hl = _mm256_mul_epu32(_mm256_srli_epi64(a, 32), b);
+	__m256i cross = _mm256_slli_epi64(_mm256_add_epi64(lh, hl), 32);
+	return _mm256_add_epi64(ll, cross);
+}
+
+static FORCE_INLINE __m256i rotr(__m256i a, uint32_t c) {
+	__m128i right = _mm_cvtsi32_si128(c);
+	__m128i left = _mm_cvtsi32_si128(64 - c);
+	return _mm256_or_si256(_mm256_srl_epi64(a, right),
+		_mm256_sll_epi64(a, left));
+}
+
+static FORCE_INLINE __m256i imm64(uint32_t imm32) {
+	return _mm256_set1_epi64x((int64_t)(int32_t)imm32);
+}
+
+int hashx_program_execute_avx2(const hashx_program* program, uint64_t r[][8]) {
+	__m256i v[8];
+	__m256i result = _mm256_setzero_si256();
+	__m256i enable = _mm256_set1_epi64x(-1);
+	/* When a branch is taken by a subset of the lanes, only those lanes
+	   are active until the branch instruction is reached again. */
+	__m256i active = enable;
+	__m256i saved_result = result;
+	int active_end = -1;
+	int target = 0;
+	for (int j = 0; j < 8; ++j) {
+		v[j] = _mm256_set_epi64x(r[3][j], r[2][j], r[1][j], r[0][j]);
+	}
+	for (int i = 0; i < program->code_size; ++i) {
+		const instruction* instr = &program->code[i];
+		__m256i x;
+		switch (instr->opcode)
+		{
+		case INSTR_UMULH_R:
+			x = result = umulh(v[instr->dst], v[instr->src]);
+			break;
+		case INSTR_SMULH_R:
+			x = result = smulh(v[instr->dst], v[instr->src]);
+			break;
+		case INSTR_MUL_R:
+			x = mul(v[instr->dst], v[instr->src]);
+			break;
+		case INSTR_SUB_R:
+			x = _mm256_sub_epi64(v[instr->dst], v[instr->src]);
+			break;
+		case INSTR_XOR_R:
+			x = _mm256_xor_si256(v[instr->dst], v[instr->src]);
+			break;
+		case INSTR_ADD_RS:
+			x = _mm256_add_epi64(v[instr->dst], _mm256_sll_epi64(
+				v[instr->src], _mm_cvtsi32_si128(instr->imm32)));
+			break;
+		case INSTR_ROR_C:
+			x = rotr(v[instr->dst], instr->imm32);
+			break;
+		case INSTR_ADD_C:
+			x = _mm256_add_epi64(v[instr->dst], imm64(instr->imm32));
+			break;
+		case INSTR_XOR_C:
+			x = _mm256_xor_si256(v[instr->dst], imm64(instr->imm32));
+			break;
+		case INSTR_TARGET:
+			target = i;
+			continue;
+		case INSTR_BRANCH:
+			if (i == active_end) {
+				/* all lanes are at the same position again */
+				result = _mm256_blendv_epi8(saved_result, result, active);
+				active = _mm256_set1_epi64x(-1);
+				active_end = -1;
+				continue;
+			}
+			__m256i mask = _mm256_set1_epi64x(instr->imm32);
+			__m256i zero = _mm256_cmpeq_epi64(_mm256_and_si256(result, mask),
+				_mm256_setzero_si256());
+			__m256i taken = _mm256_and_si256(_mm256_and_si256(enable, active),
+				zero);
+			int taken_lanes = _mm256_movemask_pd(_mm256_castsi256_pd(taken));
+			if (taken_lanes != 0) {
+				/* re-execute the block only for the lanes that took
+				   the branch; the other lanes wait until the branch
+				   instruction is reached again */
+				enable = _mm256_andnot_si256(taken, enable);
+				if (taken_lanes != LANE_MASK) {
+					active = taken;
+					active_end = i;
+					saved_result = result;
+				}
+				i = target;
+			}
+			continue;
+		default:
+			UNREACHABLE;
+		}
+		if (active_end < 0) {
+			v[instr->dst] = x;
+		}
+		else {
+			v[instr->dst] = _mm256_blendv_epi8(v[instr->dst], x, active);
+		}
+	}
+	for (int j = 0; j < 8; ++j) {
+		uint64_t lanes[LANES];
+		_mm256_storeu_si256((__m256i*)lanes, v[j]);
+		for (int k = 0; k < LANES; ++k) {
+			r[k][j] = lanes[k];
+		}
+	}
+	/* each lane takes at most one branch */
+	int enabled = _mm256_movemask_pd(_mm256_castsi256_pd(enable));
+	return LANES - hashx_popcount32((uint32_t)enabled);
+}
+
+#endif
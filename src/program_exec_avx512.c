@@ -0,0 +1,132 @@
+/* Copyright (c) 2020 tevador <tevador@gmail.com> */
+/* See LICENSE for licensing information */
+
+/* Interpreter that executes a program for 8 inputs in parallel using
+   AVX-512F and AVX-512DQ. Each vector register holds the values of one
+   HashX register for all 8 lanes. */
+
+#include "program.h"
+#include "force_inline.h"
+#include "unreachable.h"
+#include "bitops.h"
+
+#if defined(HASHX_SIMD_X86) && defined(__AVX512F__) && defined(__AVX512DQ__)
+
+#include <immintrin.h>
+
+#define LANES 8
+#define LANE_MASK 0xff
+
+/* high 64 bits of the 128-bit unsigned product from 32x32 partial products */
+static FORCE_INLINE __m512i umulh(__m512i a, __m512i b) {
+	__m512i lo32 = _mm512_set1_epi64(0xffffffff);
+	__m512i a_hi = _mm512_srli_epi64(a, 32);
+	__m512i b_hi = _mm512_srli_epi64(b, 32);
+	__m512i ll = _mm512_mul_epu32(a, b);
+	__m512i lh = _mm512_mul_epu32(a, b_hi);
+	__m512i hl = _mm512_mul_epu32(a_hi, b);
+	__m512i hh = _mm512_mul_epu32(a_hi, b_hi);
+	__m512i t = _mm512_add_epi64(hl, _mm512_srli_epi64(ll, 32));
+	__m512i u = _mm512_add_epi64(lh, _mm512_and_si512(t, lo32));
+	hh = _mm512_add_epi64(hh, _mm512_srli_epi64(t, 32));
+	return _mm512_add_epi64(hh, _mm512_srli_epi64(u, 32));
+}
+
+static FORCE_INLINE __m512i smulh(__m512i a, __m512i b) {
+	__m512i hi = umulh(a, b);
+	__m512i a_neg = _mm512_srai_epi64(a, 63);
+	__m512i b_neg = _mm512_srai_epi64(b, 63);
+	hi = _mm512_sub_epi64(hi, _mm512_and_si512(a_neg, b));
+	return _mm512_sub_epi64(hi, _mm512_and_si512(b_neg, a));
+}
+
+static FORCE_INLINE __m512i imm64(uint32_t imm32) {
+	return _mm512_set1_epi64((int64_t)(int32_t)imm32);
+}
+
+int hashx_program_execute_avx512(const hashx_program* program, uint64_t r[][8]) {
+	__m512i v[8];
+	__m512i result = _mm512_setzero_si512();
+	__mmask8 enable = LANE_MASK;
+	/* When a branch is taken by a subset of the lanes, only those lanes
+	   are active until the branch instruction is reached again. */
+	__mmask8 active = LANE_MASK;
+	int active_end = -1;
+	int target = 0;
+	__m512i index = _mm512_set_epi64(56, 48, 40, 32, 24, 16, 8, 0);
+	for (int j = 0; j < 8; ++j) {
+		v[j] = _mm512_i64gather_epi64(index, &r[0][j], 8);
+	}
+	for (int i = 0; i < program->code_size; ++i) {
+		const instruction* instr = &program->code[i];
+		__m512i x;
+		switch (instr->opcode)
+		{
+		case INSTR_UMULH_R:
+			x = umulh(v[instr->dst], v[instr->src]);
+			result = _mm512_mask_mov_epi64(result, active, x);
+			break;
+		case INSTR_SMULH_R:
+			x = smulh(v[instr->dst], v[instr->src]);
+			result = _mm512_mask_mov_epi64(result, active, x);
+			break;
+		case INSTR_MUL_R:
+			x = _mm512_mullo_epi64(v[instr->dst], v[instr->src]);
+			break;
+		case INSTR_SUB_R:
+			x = _mm512_sub_epi64(v[instr->dst], v[instr->src]);
+			break;
+		case INSTR_XOR_R:
+			x = _mm512_xor_si512(v[instr->dst], v[instr->src]);
+			break;
+		case INSTR_ADD_RS:
+			x = _mm512_add_epi64(v[instr->dst], _mm512_sll_epi64(
+				v[instr->src], _mm_cvtsi32_si128(instr->imm32)));
+			break;
+		case INSTR_ROR_C:
+			x = _mm512_rorv_epi64(v[instr->dst],
+				_mm512_set1_epi64(instr->imm32));
+			break;
+		case INSTR_ADD_C:
+			x = _mm512_add_epi64(v[instr->dst], imm64(instr->imm32));
+			break;
+		case INSTR_XOR_C:
+			x = _mm512_xor_si512(v[instr->dst], imm64(instr->imm32));
+			break;
+		case INSTR_TARGET:
+			target = i;
+			continue;
+		case INSTR_BRANCH:
+			if (i == active_end) {
+				/* all lanes are at the same position again */
+				active = LANE_MASK;
+				active_end = -1;
+				continue;
+			}
+			__mmask8 taken = _mm512_mask_testn_epi64_mask(enable & active,
+				result, _mm512_set1_epi64(instr->imm32));
+			if (taken != 0) {
+				/* re-execute the block only for the lanes that took
+				   the branch; the other lanes wait until the branch
+				   instruction is reached again */
+				enable &= ~taken;
+				if (taken != LANE_MASK) {
+					active = taken;
+					active_end = i;
+				}
+				i = target;
+			}
+			continue;
+		default:
+			UNREACHABLE;
+		}
+		v[instr->dst] = _mm512_mask_mov_epi64(v[instr->dst], active, x);
+	}
+	for (int j = 0; j < 8; ++j) {
+		_mm512_i64scatter_epi64(&r[0][j], index, v[j], 8);
+	}
+	/* each lane takes at most one branch */
+	return LANES - hashx_popcount32(enable);
+}
+
+#endif
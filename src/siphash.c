@@ -4,6 +4,12 @@
 #include "siphash.h"
 #include "hashx_endian.h"
 #include "unreachable.h"
+#include "force_inline.h"
+#include "cpu.h"
+
+#if defined(HASHX_SIMD_X86) && defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 uint64_t hashx_siphash13_ctr(uint64_t input, const siphash_state* keys) {
     uint64_t v0 = keys->v0;
@@ -25,6 +31,73 @@ uint64_t hashx_siphash13_ctr(uint64_t input, const siphash_state* keys) {
     return (v0 ^ v1) ^ (v2 ^ v3);
 }
 
+#if defined(HASHX_SIMD_X86) && defined(__SSE2__)
+/* SSE2 is available on all x86-64 CPUs */
+
+static FORCE_INLINE __m128i rotl_sse2(__m128i x, int b) {
+    return _mm_or_si128(_mm_slli_epi64(x, b), _mm_srli_epi64(x, 64 - b));
+}
+
+#define SIPROUND_SSE2(v0, v1, v2, v3)                                       \
+  do {                                                                      \
+    v0 = _mm_add_epi64(v0, v1); v2 = _mm_add_epi64(v2, v3);                 \
+    v1 = rotl_sse2(v1, 13); v3 = rotl_sse2(v3, 16);                         \
+    v1 = _mm_xor_si128(v1, v0); v3 = _mm_xor_si128(v3, v2);                 \
+    v0 = _mm_shuffle_epi32(v0, _MM_SHUFFLE(2, 3, 0, 1));                    \
+    v2 = _mm_add_epi64(v2, v1); v0 = _mm_add_epi64(v0, v3);                 \
+    v1 = rotl_sse2(v1, 17); v3 = rotl_sse2(v3, 21);                         \
+    v1 = _mm_xor_si128(v1, v2); v3 = _mm_xor_si128(v3, v0);                 \
+    v2 = _mm_shuffle_epi32(v2, _MM_SHUFFLE(2, 3, 0, 1));                    \
+  } while (0)
+
+static void siphash13_ctr2_sse2(const siphash_state* keys, uint64_t input,
+    uint64_t out[2]) {
+    __m128i in = _mm_add_epi64(_mm_set1_epi64x(input), _mm_set_epi64x(1, 0));
+    __m128i v0 = _mm_set1_epi64x(keys->v0);
+    __m128i v1 = _mm_set1_epi64x(keys->v1);
+    __m128i v2 = _mm_set1_epi64x(keys->v2);
+    __m128i v3 = _mm_xor_si128(_mm_set1_epi64x(keys->v3), in);
+
+    SIPROUND_SSE2(v0, v1, v2, v3);
+
+    v0 = _mm_xor_si128(v0, in);
+    v2 = _mm_xor_si128(v2, _mm_set1_epi64x(0xff));
+
+    SIPROUND_SSE2(v0, v1, v2, v3);
+    SIPROUND_SSE2(v0, v1, v2, v3);
+    SIPROUND_SSE2(v0, v1, v2, v3);
+
+    __m128i h = _mm_xor_si128(_mm_xor_si128(v0, v1), _mm_xor_si128(v2, v3));
+    _mm_storeu_si128((__m128i*)out, h);
+}
+#endif
+
+void hashx_siphash13_ctr_block(const siphash_state* keys, uint64_t input,
+    uint64_t out[], size_t count) {
+    size_t i = 0;
+#ifdef HASHX_SIMD_X86
+    unsigned features = hashx_cpu_features();
+    if (features & HASHX_CPU_AVX512) {
+        for (; i < count; i += 8) {
+            hashx_siphash13_ctr8_avx512(keys, input + i, &out[i]);
+        }
+    }
+    else if (features & HASHX_CPU_AVX2) {
+        for (; i < count; i += 4) {
+            hashx_siphash13_ctr4_avx2(keys, input + i, &out[i]);
+        }
+    }
+#ifdef __SSE2__
+    for (; i < count; i += 2) {
+        siphash13_ctr2_sse2(keys, input + i, &out[i]);
+    }
+#endif
+#endif
+    for (; i < count; ++i) {
+        out[i] = hashx_siphash13_ctr(input + i, keys);
+    }
+}
+
 void hashx_siphash24_ctr_state512(const siphash_state* keys, uint64_t input,
     uint64_t state_out[8]) {
 
@@ -5,6 +5,7 @@
 #define SIPHASH_H
 
 #include <stdint.h>
+#include <stddef.h>
 #include <hashx.h>
 
 #define ROTL(x, b) (((x) << (b)) | ((x) >> (64 - (b))))
@@ -26,8 +27,26 @@ extern "C" {
 #endif
 
 HASHX_PRIVATE uint64_t hashx_siphash13_ctr(uint64_t input, const siphash_state* keys);
+/* hashx_siphash13_ctr for counters input...input+count-1, where count is
+   a multiple of 8 */
+HASHX_PRIVATE void hashx_siphash13_ctr_block(const siphash_state* keys, uint64_t input, uint64_t out[], size_t count);
 HASHX_PRIVATE void hashx_siphash24_ctr_state512(const siphash_state* keys, uint64_t input, uint64_t state_out[8]);
 
+/* State expansion for counters input...input+3 (AVX2) */
+HASHX_PRIVATE void hashx_siphash24_ctr_state512_avx2(const siphash_state* keys, uint64_t input, uint64_t state_out[][8]);
+/* State expansion for counters input...input+7 (AVX-512) */
+HASHX_PRIVATE void hashx_siphash24_ctr_state512_avx512(const siphash_state* keys, uint64_t input, uint64_t state_out[][8]);
+
+/* hashx_siphash13_ctr for counters input...input+3 (AVX2) */
+HASHX_PRIVATE void hashx_siphash13_ctr4_avx2(const siphash_state* keys, uint64_t input, uint64_t out[4]);
+/* hashx_siphash13_ctr for counters input...input+7 (AVX-512) */
+HASHX_PRIVATE void hashx_siphash13_ctr8_avx512(const siphash_state* keys, uint64_t input, uint64_t out[8]);
+
+/* Counter mode hash finalization of 4 (AVX2) or 8 (AVX-512) states in place:
+   adds the keys and applies one SipRound to each half of the state. */
+HASHX_PRIVATE void hashx_siphash_finalize_avx2(const siphash_state* keys, uint64_t r[][8]);
+HASHX_PRIVATE void hashx_siphash_finalize_avx512(const siphash_state* keys, uint64_t r[][8]);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,148 @@
+/* Copyright (c) 2020 tevador <tevador@gmail.com> */
+/* See LICENSE for licensing information */
+
+/* SipHash for 4 consecutive counter values in parallel using AVX2. */
+
+#include "siphash.h"
+#include "force_inline.h"
+
+#if defined(HASHX_SIMD_X86) && defined(__AVX2__)
+
+#include <immintrin.h>
+
+static FORCE_INLINE __m256i rotl(__m256i x, int b) {
+	return _mm256_or_si256(_mm256_slli_epi64(x, b), _mm256_srli_epi64(x, 64 - b));
+}
+
+static FORCE_INLINE __m256i rotl16(__m256i x) {
+	const __m256i shuffle = _mm256_setr_epi8(
+		6, 7, 0, 1, 2, 3, 4, 5, 14, 15, 8, 9, 10, 11, 12, 13,
+		6, 7, 0, 1, 2, 3, 4, 5, 14, 15, 8, 9, 10, 11, 12, 13);
+	return _mm256_shuffle_epi8(x, shuffle);
+}
+
+static FORCE_INLINE __m256i rotl32(__m256i x) {
+	return _mm256_shuffle_epi32(x, _MM_SHUFFLE(2, 3, 0, 1));
+}
+
+#define SIPROUND_AVX2(v0, v1, v2, v3)                                       \
+  do {                                                                      \
+    v0 = _mm256_add_epi64(v0, v1); v2 = _mm256_add_epi64(v2, v3);           \
+    v1 = rotl(v1, 13); v3 = rotl16(v3);                                     \
+    v1 = _mm256_xor_si256(v1, v0); v3 = _mm256_xor_si256(v3, v2);           \
+    v0 = rotl32(v0);                                                        \
+    v2 = _mm256_add_epi64(v2, v1); v0 = _mm256_add_epi64(v0, v3);           \
+    v1 = rotl(v1, 17); v3 = rotl(v3, 21);                                   \
+    v1 = _mm256_xor_si256(v1, v2); v3 = _mm256_xor_si256(v3, v0);           \
+    v2 = rotl32(v2);                                                        \
+  } while (0)
+
+/* stores 4 vectors of 4 lanes as 4 rows of r[lane][offset..offset+3] */
+static FORCE_INLINE void store_transposed(__m256i a, __m256i b, __m256i c,
+	__m256i d, uint64_t r[][8], int offset) {
+	__m256i ab_lo = _mm256_unpacklo_epi64(a, b);
+	__m256i ab_hi = _mm256_unpackhi_epi64(a, b);
+	__m256i cd_lo = _mm256_unpacklo_epi64(c, d);
+	__m256i cd_hi = _mm256_unpackhi_epi64(c, d);
+	_mm256_storeu_si256((__m256i*)&r[0][offset],
+		_mm256_permute2x128_si256(ab_lo, cd_lo, 0x20));
+	_mm256_storeu_si256((__m256i*)&r[1][offset],
+		_mm256_permute2x128_si256(ab_hi, cd_hi, 0x20));
+	_mm256_storeu_si256((__m256i*)&r[2][offset],
+		_mm256_permute2x128_si256(ab_lo, cd_lo, 0x31));
+	_mm256_storeu_si256((__m256i*)&r[3][offset],
+		_mm256_permute2x128_si256(ab_hi, cd_hi, 0x31));
+}
+
+/* the inverse of store_transposed */
+static FORCE_INLINE void load_transposed(__m256i* a, __m256i* b, __m256i* c,
+	__m256i* d, uint64_t r[][8], int offset) {
+	__m256i r0 = _mm256_loadu_si256((const __m256i*)&r[0][offset]);
+	__m256i r1 = _mm256_loadu_si256((const __m256i*)&r[1][offset]);
+	__m256i r2 = _mm256_loadu_si256((const __m256i*)&r[2][offset]);
+	__m256i r3 = _mm256_loadu_si256((const __m256i*)&r[3][offset]);
+	__m256i lo01 = _mm256_unpacklo_epi64(r0, r1);
+	__m256i hi01 = _mm256_unpackhi_epi64(r0, r1);
+	__m256i lo23 = _mm256_unpacklo_epi64(r2, r3);
+	__m256i hi23 = _mm256_unpackhi_epi64(r2, r3);
+	*a = _mm256_permute2x128_si256(lo01, lo23, 0x20);
+	*b = _mm256_permute2x128_si256(hi01, hi23, 0x20);
+	*c = _mm256_permute2x128_si256(lo01, lo23, 0x31);
+	*d = _mm256_permute2x128_si256(hi01, hi23, 0x31);
+}
+
+void hashx_siphash24_ctr_state512_avx2(const siphash_state* keys,
+	uint64_t input, uint64_t state_out[][8]) {
+
+	__m256i in = _mm256_add_epi64(_mm256_set1_epi64x(input),
+		_mm256_setr_epi64x(0, 1, 2, 3));
+	__m256i v0 = _mm256_set1_epi64x(keys->v0);
+	__m256i v1 = _mm256_set1_epi64x(keys->v1 ^ 0xee);
+	__m256i v2 = _mm256_set1_epi64x(keys->v2);
+	__m256i v3 = _mm256_xor_si256(_mm256_set1_epi64x(keys->v3), in);
+
+	SIPROUND_AVX2(v0, v1, v2, v3);
+	SIPROUND_AVX2(v0, v1, v2, v3);
+
+	v0 = _mm256_xor_si256(v0, in);
+	v2 = _mm256_xor_si256(v2, _mm256_set1_epi64x(0xee));
+
+	SIPROUND_AVX2(v0, v1, v2, v3);
+	SIPROUND_AVX2(v0, v1, v2, v3);
+	SIPROUND_AVX2(v0, v1, v2, v3);
+	SIPROUND_AVX2(v0, v1, v2, v3);
+
+	store_transposed(v0, v1, v2, v3, state_out, 0);
+
+	v1 = _mm256_xor_si256(v1, _mm256_set1_epi64x(0xdd));
+
+	SIPROUND_AVX2(v0, v1, v2, v3);
+	SIPROUND_AVX2(v0, v1, v2, v3);
+	SIPROUND_AVX2(v0, v1, v2, v3);
+	SIPROUND_AVX2(v0, v1, v2, v3);
+
+	store_transposed(v0, v1, v2, v3, state_out, 4);
+}
+
+void hashx_siphash13_ctr4_avx2(const siphash_state* keys, uint64_t input,
+	uint64_t out[4]) {
+
+	__m256i in = _mm256_add_epi64(_mm256_set1_epi64x(input),
+		_mm256_setr_epi64x(0, 1, 2, 3));
+	__m256i v0 = _mm256_set1_epi64x(keys->v0);
+	__m256i v1 = _mm256_set1_epi64x(keys->v1);
+	__m256i v2 = _mm256_set1_epi64x(keys->v2);
+	__m256i v3 = _mm256_xor_si256(_mm256_set1_epi64x(keys->v3), in);
+
+	SIPROUND_AVX2(v0, v1, v2, v3);
+
+	v0 = _mm256_xor_si256(v0, in);
+	v2 = _mm256_xor_si256(v2, _mm256_set1_epi64x(0xff));
+
+	SIPROUND_AVX2(v0, v1, v2, v3);
+	SIPROUND_AVX2(v0, v1, v2, v3);
+	SIPROUND_AVX2(v0, v1, v2, v3);
+
+	__m256i h = _mm256_xor_si256(_mm256_xor_si256(v0, v1),
+		_mm256_xor_si256(v2, v3));
+	_mm256_storeu_si256((__m256i*)out, h);
+}
+
+void hashx_siphash_finalize_avx2(const siphash_state* keys, uint64_t r[][8]) {
+	__m256i r0, r1, r2, r3, r4, r5, r6, r7;
+	load_transposed(&r0, &r1, &r2, &r3, r, 0);
+	load_transposed(&r4, &r5, &r6, &r7, r, 4);
+
+	r0 = _mm256_add_epi64(r0, _mm256_set1_epi64x(keys->v0));
+	r1 = _mm256_add_epi64(r1, _mm256_set1_epi64x(keys->v1));
+	r6 = _mm256_add_epi64(r6, _mm256_set1_epi64x(keys->v2));
+	r7 = _mm256_add_epi64(r7, _mm256_set1_epi64x(keys->v3));
+
+	SIPROUND_AVX2(r0, r1, r2, r3);
+	SIPROUND_AVX2(r4, r5, r6, r7);
+
+	store_transposed(r0, r1, r2, r3, r, 0);
+	store_transposed(r4, r5, r6, r7, r, 4);
+}
+
+#endif
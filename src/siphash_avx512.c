@@ -0,0 +1,121 @@
+/* Copyright (c) 2020 tevador <tevador@gmail.com> */
+/* See LICENSE for licensing information */
+
+/* SipHash for 8 consecutive counter values in parallel using AVX-512F. */
+
+#include "siphash.h"
+#include "force_inline.h"
+
+#if defined(HASHX_SIMD_X86) && defined(__AVX512F__)
+
+#include <immintrin.h>
+
+#define SIPROUND_AVX512(v0, v1, v2, v3)                                     \
+  do {                                                                      \
+    v0 = _mm512_add_epi64(v0, v1); v2 = _mm512_add_epi64(v2, v3);           \
+    v1 = _mm512_rol_epi64(v1, 13); v3 = _mm512_rol_epi64(v3, 16);           \
+    v1 = _mm512_xor_si512(v1, v0); v3 = _mm512_xor_si512(v3, v2);           \
+    v0 = _mm512_rol_epi64(v0, 32);                                          \
+    v2 = _mm512_add_epi64(v2, v1); v0 = _mm512_add_epi64(v0, v3);           \
+    v1 = _mm512_rol_epi64(v1, 17); v3 = _mm512_rol_epi64(v3, 21);           \
+    v1 = _mm512_xor_si512(v1, v2); v3 = _mm512_xor_si512(v3, v0);           \
+    v2 = _mm512_rol_epi64(v2, 32);                                          \
+  } while (0)
+
+/* offsets of r[lane][0] for all 8 lanes in units of uint64_t */
+#define LANE_INDEX _mm512_set_epi64(56, 48, 40, 32, 24, 16, 8, 0)
+
+void hashx_siphash24_ctr_state512_avx512(const siphash_state* keys,
+	uint64_t input, uint64_t state_out[][8]) {
+
+	__m512i index = LANE_INDEX;
+	__m512i in = _mm512_add_epi64(_mm512_set1_epi64(input),
+		_mm512_set_epi64(7, 6, 5, 4, 3, 2, 1, 0));
+	__m512i v0 = _mm512_set1_epi64(keys->v0);
+	__m512i v1 = _mm512_set1_epi64(keys->v1 ^ 0xee);
+	__m512i v2 = _mm512_set1_epi64(keys->v2);
+	__m512i v3 = _mm512_xor_si512(_mm512_set1_epi64(keys->v3), in);
+
+	SIPROUND_AVX512(v0, v1, v2, v3);
+	SIPROUND_AVX512(v0, v1, v2, v3);
+
+	v0 = _mm512_xor_si512(v0, in);
+	v2 = _mm512_xor_si512(v2, _mm512_set1_epi64(0xee));
+
+	SIPROUND_AVX512(v0, v1, v2, v3);
+	SIPROUND_AVX512(v0, v1, v2, v3);
+	SIPROUND_AVX512(v0, v1, v2, v3);
+	SIPROUND_AVX512(v0, v1, v2, v3);
+
+	_mm512_i64scatter_epi64(&state_out[0][0], index, v0, 8);
+	_mm512_i64scatter_epi64(&state_out[0][1], index, v1, 8);
+	_mm512_i64scatter_epi64(&state_out[0][2], index, v2, 8);
+	_mm512_i64scatter_epi64(&state_out[0][3], index, v3, 8);
+
+	v1 = _mm512_xor_si512(v1, _mm512_set1_epi64(0xdd));
+
+	SIPROUND_AVX512(v0, v1, v2, v3);
+	SIPROUND_AVX512(v0, v1, v2, v3);
+	SIPROUND_AVX512(v0, v1, v2, v3);
+	SIPROUND_AVX512(v0, v1, v2, v3);
+
+	_mm512_i64scatter_epi64(&state_out[0][4], index, v0, 8);
+	_mm512_i64scatter_epi64(&state_out[0][5], index, v1, 8);
+	_mm512_i64scatter_epi64(&state_out[0][6], index, v2, 8);
+	_mm512_i64scatter_epi64(&state_out[0][7], index, v3, 8);
+}
+
+void hashx_siphash13_ctr8_avx512(const siphash_state* keys, uint64_t input,
+	uint64_t out[8]) {
+
+	__m512i in = _mm512_add_epi64(_mm512_set1_epi64(input),
+		_mm512_set_epi64(7, 6, 5, 4, 3, 2, 1, 0));
+	__m512i v0 = _mm512_set1_epi64(keys->v0);
+	__m512i v1 = _mm512_set1_epi64(keys->v1);
+	__m512i v2 = _mm512_set1_epi64(keys->v2);
+	__m512i v3 = _mm512_xor_si512(_mm512_set1_epi64(keys->v3), in);
+
+	SIPROUND_AVX512(v0, v1, v2, v3);
+
+	v0 = _mm512_xor_si512(v0, in);
+	v2 = _mm512_xor_si512(v2, _mm512_set1_epi64(0xff));
+
+	SIPROUND_AVX512(v0, v1, v2, v3);
+	SIPROUND_AVX512(v0, v1, v2, v3);
+	SIPROUND_AVX512(v0, v1, v2, v3);
+
+	__m512i h = _mm512_xor_si512(_mm512_xor_si512(v0, v1),
+		_mm512_xor_si512(v2, v3));
+	_mm512_storeu_si512(out, h);
+}
+
+void hashx_siphash_finalize_avx512(const siphash_state* keys, uint64_t r[][8]) {
+	__m512i index = LANE_INDEX;
+	__m512i r0 = _mm512_i64gather_epi64(index, &r[0][0], 8);
+	__m512i r1 = _mm512_i64gather_epi64(index, &r[0][1], 8);
+	__m512i r2 = _mm512_i64gather_epi64(index, &r[0][2], 8);
+	__m512i r3 = _mm512_i64gather_epi64(index, &r[0][3], 8);
+	__m512i r4 = _mm512_i64gather_epi64(index, &r[0][4], 8);
+	__m512i r5 = _mm512_i64gather_epi64(index, &r[0][5], 8);
+	__m512i r6 = _mm512_i64gather_epi64(index, &r[0][6], 8);
+	__m512i r7 = _mm512_i64gather_epi64(index, &r[0][7], 8);
+
+	r0 = _mm512_add_epi64(r0, _mm512_set1_epi64(keys->v0));
+	r1 = _mm512_add_epi64(r1, _mm512_set1_epi64(keys->v1));
+	r6 = _mm512_add_epi64(r6, _mm512_set1_epi64(keys->v2));
+	r7 = _mm512_add_epi64(r7, _mm512_set1_epi64(keys->v3));
+
+	SIPROUND_AVX512(r0, r1, r2, r3);
+	SIPROUND_AVX512(r4, r5, r6, r7);
+
+	_mm512_i64scatter_epi64(&r[0][0], index, r0, 8);
+	_mm512_i64scatter_epi64(&r[0][1], index, r1, 8);
+	_mm512_i64scatter_epi64(&r[0][2], index, r2, 8);
+	_mm512_i64scatter_epi64(&r[0][3], index, r3, 8);
+	_mm512_i64scatter_epi64(&r[0][4], index, r4, 8);
+	_mm512_i64scatter_epi64(&r[0][5], index, r5, 8);
+	_mm512_i64scatter_epi64(&r[0][6], index, r6, 8);
+	_mm512_i64scatter_epi64(&r[0][7], index, r7, 8);
+}
+
+#endif
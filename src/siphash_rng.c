@@ -8,24 +8,11 @@ void hashx_siphash_rng_init(siphash_rng* gen, const siphash_state* state) {
 	gen->counter = 0;
 	gen->count8 = 0;
 	gen->count32 = 0;
+	gen->block_pos = SIPHASH_RNG_BLOCK;
 }
 
-uint8_t hashx_siphash_rng_u8(siphash_rng* gen) {
-	if (gen->count8 == 0) {
-		gen->buffer8 = hashx_siphash13_ctr(gen->counter, &gen->keys);
-		gen->counter++;
-		gen->count8 = sizeof(gen->buffer8);
-	}
-	gen->count8--;
-	return gen->buffer8 >> (gen->count8 * 8);
-}
-
-uint32_t hashx_siphash_rng_u32(siphash_rng* gen) {
-	if (gen->count32 == 0) {
-		gen->buffer32 = hashx_siphash13_ctr(gen->counter, &gen->keys);
-		gen->counter++;
-		gen->count32 = sizeof(gen->buffer32) / sizeof(uint32_t);
-	}
-	gen->count32--;
-	return gen->buffer32 >> (gen->count32 * 32);
+void hashx_siphash_rng_refill(siphash_rng* gen) {
+	hashx_siphash13_ctr_block(&gen->keys, gen->counter, gen->block,
+		SIPHASH_RNG_BLOCK);
+	gen->block_pos = 0;
 }
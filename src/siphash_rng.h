@@ -7,12 +7,20 @@
 #include <stdint.h>
 #include <hashx.h>
 #include "siphash.h"
+#include "force_inline.h"
+
+/* number of SipHash outputs computed at once */
+#define SIPHASH_RNG_BLOCK 64
 
 typedef struct siphash_rng {
 	siphash_state keys;
 	uint64_t counter;
 	uint64_t buffer8, buffer32;
 	unsigned count8, count32;
+	/* The stream is precomputed in blocks. block_pos is the index of the
+	   output for the current counter value. */
+	unsigned block_pos;
+	uint64_t block[SIPHASH_RNG_BLOCK];
 } siphash_rng;
 
 #ifdef __cplusplus
@@ -20,11 +28,38 @@ extern "C" {
 #endif
 
 HASHX_PRIVATE void hashx_siphash_rng_init(siphash_rng* gen, const siphash_state* state);
-HASHX_PRIVATE uint32_t hashx_siphash_rng_u32(siphash_rng* gen);
-HASHX_PRIVATE uint8_t hashx_siphash_rng_u8(siphash_rng* gen);
+HASHX_PRIVATE void hashx_siphash_rng_refill(siphash_rng* gen);
 
 #ifdef __cplusplus
 }
 #endif
 
+/* Both buffers are refilled from a single stream of SipHash outputs
+   for consecutive counter values. */
+static FORCE_INLINE uint64_t hashx_siphash_rng_next(siphash_rng* gen) {
+	if (gen->block_pos == SIPHASH_RNG_BLOCK) {
+		hashx_siphash_rng_refill(gen);
+	}
+	gen->counter++;
+	return gen->block[gen->block_pos++];
+}
+
+static FORCE_INLINE uint8_t hashx_siphash_rng_u8(siphash_rng* gen) {
+	if (gen->count8 == 0) {
+		gen->buffer8 = hashx_siphash_rng_next(gen);
+		gen->count8 = sizeof(gen->buffer8);
+	}
+	gen->count8--;
+	return gen->buffer8 >> (gen->count8 * 8);
+}
+
+static FORCE_INLINE uint32_t hashx_siphash_rng_u32(siphash_rng* gen) {
+	if (gen->count32 == 0) {
+		gen->buffer32 = hashx_siphash_rng_next(gen);
+		gen->count32 = sizeof(gen->buffer32) / sizeof(uint32_t);
+	}
+	gen->count32--;
+	return gen->buffer32 >> (gen->count32 * 32);
+}
+
 #endif
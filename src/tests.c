@@ -7,6 +7,12 @@
 
 #include <assert.h>
 #include "test_utils.h"
+#include "hashx_endian.h"
+#include "hashx_thread.h"
+#include "program.h"
+#include "context.h"
+#include "blake2.h"
+#include "cpu.h"
 
 typedef bool test_func();
 
@@ -32,6 +38,12 @@ static const unsigned char long_input[] = {
 	0xbd, 0x82, 0xf4, 0x16
 };
 
+#define BATCH_SIZE 37
+#define SEARCH_SIZE 256
+
+/* can be increased with --generator-seeds */
+static int generator_seeds;
+
 #define RUN_TEST(x) run_test(#x, &x)
 
 static void run_test(const char* name, test_func* func) {
@@ -122,6 +134,85 @@ static bool test_hash_ctr4() {
 #endif
 }
 
+static bool test_batch_ctr1() {
+#ifndef HASHX_BLOCK_MODE
+	char hashes[BATCH_SIZE * HASHX_SIZE];
+	hashx_exec_batch(ctx_int, counter2, BATCH_SIZE, hashes);
+	for (int i = 0; i < BATCH_SIZE; ++i) {
+		char hash[HASHX_SIZE];
+		hashx_exec(ctx_int, counter2 + i, hash);
+		assert(hashes_equal(hash, &hashes[i * HASHX_SIZE]));
+	}
+	return true;
+#else
+	return false;
+#endif
+}
+
+static bool test_batch_ctr2() {
+#ifndef HASHX_BLOCK_MODE
+	/* different group sizes select different interpreter implementations */
+	static const int group_sizes[] = { 1, 3, 4, 8, 64 };
+	hashx_ctx* ctx = hashx_alloc(HASHX_INTERPRETED);
+	assert(ctx != NULL && ctx != HASHX_NOTSUPP);
+	for (int seed = 0; seed < 20; ++seed) {
+		if (!hashx_make(ctx, &seed, sizeof(seed)))
+			continue;
+		for (int g = 0; g < sizeof(group_sizes) / sizeof(int); ++g) {
+			char hashes[64 * HASHX_SIZE];
+			int size = group_sizes[g];
+			for (uint64_t nonce = 0; nonce < 64; nonce += size) {
+				hashx_exec_batch(ctx, nonce, size, hashes);
+				for (int i = 0; i < size; ++i) {
+					char hash[HASHX_SIZE];
+					hashx_exec(ctx, nonce + i, hash);
+					assert(hashes_equal(hash, &hashes[i * HASHX_SIZE]));
+				}
+			}
+		}
+	}
+	hashx_free(ctx);
+	return true;
+#else
+	return false;
+#endif
+}
+
+static bool test_search_ctr1() {
+#ifndef HASHX_BLOCK_MODE
+	uint64_t values[SEARCH_SIZE];
+	for (int i = 0; i < SEARCH_SIZE; ++i) {
+		uint8_t hash[HASHX_SIZE > 8 ? HASHX_SIZE : 8] = { 0 };
+		hashx_exec(ctx_int, counter2 + i, hash);
+		values[i] = load64(hash);
+	}
+	/* about 1 in 8 nonces is below the target */
+	uint64_t target = UINT64_MAX / 8;
+	uint64_t results[SEARCH_SIZE];
+	size_t found = hashx_search(ctx_int, counter2, SEARCH_SIZE, target,
+		results, SEARCH_SIZE);
+	size_t expected = 0;
+	for (int i = 0; i < SEARCH_SIZE; ++i) {
+		if (values[i] < target) {
+			assert(expected < found);
+			assert(results[expected] == counter2 + i);
+			expected++;
+		}
+	}
+	assert(found == expected && found > 1);
+	/* the search stops when the results array is full */
+	uint64_t first;
+	assert(hashx_search(ctx_int, counter2, SEARCH_SIZE, target,
+		&first, 1) == 1);
+	assert(first == results[0]);
+	assert(hashx_search(ctx_int, counter2, SEARCH_SIZE, 0,
+		results, SEARCH_SIZE) == 0);
+	return true;
+#else
+	return false;
+#endif
+}
+
 static bool test_hash_block1() {
 #ifdef HASHX_SALT
 	return false;
@@ -183,6 +274,508 @@ static bool test_compiler_ctr2() {
 #endif
 }
 
+static bool test_compiler_batch1() {
+	if (ctx_cmp == HASHX_NOTSUPP)
+		return false;
+
+#ifndef HASHX_BLOCK_MODE
+	char hashes1[BATCH_SIZE * HASHX_SIZE];
+	char hashes2[BATCH_SIZE * HASHX_SIZE];
+	hashx_exec_batch(ctx_int, counter3, BATCH_SIZE, hashes1);
+	hashx_exec_batch(ctx_cmp, counter3, BATCH_SIZE, hashes2);
+	assert(memcmp(hashes1, hashes2, sizeof(hashes1)) == 0);
+	for (int i = 0; i < BATCH_SIZE; ++i) {
+		char hash[HASHX_SIZE];
+		hashx_exec(ctx_cmp, counter3 + i, hash);
+		assert(hashes_equal(hash, &hashes2[i * HASHX_SIZE]));
+	}
+	return true;
+#else
+	return false;
+#endif
+}
+
+static void hash_test_input(hashx_ctx* ctx, void* hash) {
+#ifndef HASHX_BLOCK_MODE
+	hashx_exec(ctx, counter2, hash);
+#else
+	hashx_exec(ctx, long_input, sizeof(long_input), hash);
+#endif
+}
+
+static bool test_arena1() {
+	if (ctx_cmp == HASHX_NOTSUPP)
+		return false;
+
+	/* more instances than the initial capacity of the arena */
+	hashx_ctx* ctx[6];
+	hashx_arena* arena = hashx_arena_alloc(4);
+	assert(arena != NULL);
+	hashx_ctx* ctx_ref = hashx_alloc(HASHX_INTERPRETED);
+	assert(ctx_ref != NULL && ctx_ref != HASHX_NOTSUPP);
+	for (int i = 0; i < 6; ++i) {
+		ctx[i] = hashx_alloc_arena(HASHX_COMPILED, arena);
+		assert(ctx[i] != NULL && ctx[i] != HASHX_NOTSUPP);
+	}
+	hashx_arena_begin(arena);
+	for (int i = 0; i < 6; ++i) {
+		assert(hashx_make(ctx[i], &i, sizeof(i)) == 1);
+	}
+	hashx_arena_end(arena);
+	for (int i = 0; i < 6; ++i) {
+		char hash1[HASHX_SIZE];
+		char hash2[HASHX_SIZE];
+		assert(hashx_make(ctx_ref, &i, sizeof(i)) == 1);
+		hash_test_input(ctx_ref, hash1);
+		hash_test_input(ctx[i], hash2);
+		assert(hashes_equal(hash1, hash2));
+	}
+	/* a freed slot is reused and can be compiled outside of a session */
+	hashx_free(ctx[0]);
+	ctx[0] = hashx_alloc_arena(HASHX_COMPILED, arena);
+	assert(ctx[0] != NULL && ctx[0] != HASHX_NOTSUPP);
+	assert(hashx_make(ctx[0], seed2, sizeof(seed2)) == 1);
+	char hash1[HASHX_SIZE];
+	char hash2[HASHX_SIZE];
+	hash_test_input(ctx[0], hash1);
+	hash_test_input(ctx_cmp, hash2);
+	assert(hashes_equal(hash1, hash2));
+	for (int i = 0; i < 6; ++i) {
+		hashx_free(ctx[i]);
+	}
+	hashx_free(ctx_ref);
+	hashx_arena_free(arena);
+	return true;
+}
+
+static bool test_generate1() {
+	hashx_func* func = hashx_func_alloc();
+	assert(func != NULL);
+	assert(hashx_generate(func, seed2, sizeof(seed2)) == 1);
+	hashx_ctx* ctx = hashx_alloc(HASHX_INTERPRETED);
+	assert(ctx != NULL && ctx != HASHX_NOTSUPP);
+	hashx_attach(ctx, func);
+	char hash1[HASHX_SIZE];
+	char hash2[HASHX_SIZE];
+	hash_test_input(ctx_int, hash1);
+	hash_test_input(ctx, hash2);
+	assert(hashes_equal(hash1, hash2));
+	if (ctx_cmp != HASHX_NOTSUPP) {
+		hashx_ctx* ctx_jit = hashx_alloc(HASHX_COMPILED);
+		assert(ctx_jit != NULL && ctx_jit != HASHX_NOTSUPP);
+		hashx_attach(ctx_jit, func);
+		hash_test_input(ctx_jit, hash2);
+		assert(hashes_equal(hash1, hash2));
+		hashx_free(ctx_jit);
+	}
+	/* seeds are rejected by both stages in the same way */
+	for (int seed = 0; seed < 100; ++seed) {
+		assert(hashx_generate(func, &seed, sizeof(seed)) ==
+			hashx_make(ctx, &seed, sizeof(seed)));
+	}
+	hashx_free(ctx);
+	hashx_func_free(func);
+	return true;
+}
+
+static bool test_generator1() {
+	/* the fast generator must produce the same programs as the reference */
+	static hashx_program program1, program2;
+	for (int seed = 0; seed < generator_seeds; ++seed) {
+		siphash_state keys[2];
+		hashx_seed_keys(&seed, sizeof(seed), keys);
+		memset(&program1, 0, sizeof(program1));
+		memset(&program2, 0, sizeof(program2));
+		bool result1 = hashx_program_generate_ref(&keys[0], &program1);
+		bool result2 = hashx_program_generate(&keys[0], &program2);
+		assert(result1 == result2);
+		assert(memcmp(&program1, &program2, sizeof(program1)) == 0);
+	}
+	return true;
+}
+
+static bool test_interpreter1() {
+	/* the decoded program must give the same results as the original */
+	static hashx_program program;
+	static hashx_decoded_program decoded;
+	for (int seed = 0; seed < generator_seeds / 10; ++seed) {
+		siphash_state keys[2];
+		hashx_seed_keys(&seed, sizeof(seed), keys);
+		hashx_program_generate(&keys[0], &program);
+		hashx_program_decode(&program, &decoded);
+		for (uint64_t input = 0; input < 16; ++input) {
+			uint64_t r1[8], r2[8];
+			hashx_siphash24_ctr_state512(&keys[1], input, r1);
+			memcpy(r2, r1, sizeof(r1));
+			hashx_program_execute(&program, r1);
+			hashx_program_execute_decoded(&decoded, r2);
+			assert(memcmp(r1, r2, sizeof(r1)) == 0);
+		}
+	}
+	return true;
+}
+
+static bool test_clone1() {
+	const hashx_type types[] = { HASHX_INTERPRETED, HASHX_COMPILED };
+	int type_count = ctx_cmp == HASHX_NOTSUPP ? 1 : 2;
+	for (int t = 0; t < type_count; ++t) {
+		hashx_ctx* source = hashx_alloc(types[t]);
+		hashx_ctx* clone = hashx_alloc(types[t]);
+		assert(source != NULL && source != HASHX_NOTSUPP);
+		assert(clone != NULL && clone != HASHX_NOTSUPP);
+		assert(hashx_make(source, seed2, sizeof(seed2)) == 1);
+		assert(hashx_make(clone, seed1, sizeof(seed1)) == 1);
+		hashx_clone(clone, source);
+		char hash1[HASHX_SIZE];
+		char hash2[HASHX_SIZE];
+		hash_test_input(source, hash1);
+		/* the clone doesn't depend on the source */
+		hashx_free(source);
+		hash_test_input(clone, hash2);
+		assert(hashes_equal(hash1, hash2));
+		hashx_free(clone);
+	}
+	return true;
+}
+
+static bool test_blake2b1() {
+	/* BLAKE2b-512 test vector from RFC 7693 */
+	blake2b_param params = { 0 };
+	params.digest_length = BLAKE2B_OUTBYTES;
+	params.fanout = 1;
+	params.depth = 1;
+	blake2b_state state;
+	char hash[BLAKE2B_OUTBYTES];
+	char reference[BLAKE2B_OUTBYTES];
+	hashx_blake2b_init_param(&state, &params);
+	hashx_blake2b_update(&state, "abc", 3);
+	hashx_blake2b_final(&state, hash, sizeof(hash));
+	hex2bin("ba80a53f981c4d0d6a2797b69f12f6e94c212f14685ac4b74b12bb6fdbffa2d1"
+		"7d87c5392aab792dc252d5de4533cc9518d38aa8dbf1925ab92386edd4009923",
+		2 * BLAKE2B_OUTBYTES, reference);
+	assert(memcmp(hash, reference, sizeof(hash)) == 0);
+#ifdef HASHX_SIMD_X86
+	/* the SIMD implementations must agree with each other */
+	unsigned features = hashx_cpu_features();
+	if ((features & HASHX_CPU_SSE41) && (features & HASHX_CPU_AVX2)) {
+		uint8_t block[BLAKE2B_BLOCKBYTES];
+		for (int i = 0; i < BLAKE2B_BLOCKBYTES; ++i) {
+			block[i] = (uint8_t)(i * 7 + 1);
+		}
+		for (int rounds = 4; rounds <= 12; rounds += 8) {
+			blake2b_state state1 = state;
+			blake2b_state state2 = state;
+			hashx_blake2b_compress_sse41(&state1, block, rounds);
+			hashx_blake2b_compress_avx2(&state2, block, rounds);
+			assert(memcmp(state1.h, state2.h, sizeof(state1.h)) == 0);
+		}
+	}
+#endif
+	return true;
+}
+
+static bool test_cache1() {
+	hashx_cache* cache = hashx_cache_alloc(HASHX_INTERPRETED, 1);
+	assert(cache != NULL);
+	hashx_ctx* ctx1 = hashx_cache_get(cache, seed2, sizeof(seed2));
+	hashx_ctx* ctx2 = hashx_cache_get(cache, seed2, sizeof(seed2));
+	assert(ctx1 != NULL && ctx1 == ctx2);
+	char hash1[HASHX_SIZE];
+	char hash2[HASHX_SIZE];
+	hash_test_input(ctx_int, hash1);
+	hash_test_input(ctx1, hash2);
+	assert(hashes_equal(hash1, hash2));
+	hashx_cache_release(cache, ctx2);
+	/* evict seed2 while it is still in use */
+	for (int i = 0; i < 2; ++i) {
+		hashx_ctx* ctx = hashx_cache_get(cache, &i, sizeof(i));
+		assert(ctx != NULL && ctx != ctx1);
+		hashx_cache_release(cache, ctx);
+	}
+	hash_test_input(ctx1, hash2);
+	assert(hashes_equal(hash1, hash2));
+	hashx_cache_release(cache, ctx1);
+	ctx2 = hashx_cache_get(cache, seed2, sizeof(seed2));
+	assert(ctx2 != NULL);
+	hashx_cache_release(cache, ctx2);
+	uint64_t hits, misses;
+	hashx_cache_stats(cache, &hits, &misses);
+	assert(hits == 1 && misses == 4);
+	hashx_cache_free(cache);
+	return true;
+}
+
+#define CACHE_THREADS 4
+#define CACHE_SEEDS 8
+
+typedef struct cache_job {
+	hashx_cache* cache;
+	char (*hashes)[HASHX_SIZE];
+	bool ok;
+} cache_job;
+
+static hashx_thread_retval cache_worker(void* args) {
+	cache_job* job = (cache_job*)args;
+	job->ok = true;
+	for (int i = 0; i < 100; ++i) {
+		int seed = (i * 5) % CACHE_SEEDS;
+		hashx_ctx* ctx = hashx_cache_get(job->cache, &seed, sizeof(seed));
+		if (ctx == NULL) {
+			continue;
+		}
+		char hash[HASHX_SIZE];
+		hash_test_input(ctx, hash);
+		job->ok &= hashes_equal(hash, job->hashes[seed]);
+		hashx_cache_release(job->cache, ctx);
+	}
+	return HASHX_THREAD_SUCCESS;
+}
+
+static bool test_cache3() {
+	/* the capacity bounds the number of instances in all shards */
+	static const size_t capacities[] = { 1, 5, 17, 40 };
+	for (size_t c = 0; c < sizeof(capacities) / sizeof(capacities[0]); ++c) {
+		size_t capacity = capacities[c];
+		hashx_cache* cache = hashx_cache_alloc(HASHX_INTERPRETED, capacity);
+		assert(cache != NULL);
+		int seeds = 0;
+		for (int seed = 0; seeds < (int)(3 * capacity); ++seed) {
+			hashx_ctx* ctx = hashx_cache_get(cache, &seed, sizeof(seed));
+			if (ctx != NULL) {
+				hashx_cache_release(cache, ctx);
+				seeds++;
+			}
+			assert(hashx_cache_size(cache) <= capacity);
+		}
+		if (capacity < 32) {
+			/* a single shard is filled up to the capacity */
+			assert(hashx_cache_size(cache) == capacity);
+		}
+		hashx_cache_free(cache);
+	}
+	/* exact LRU order of a small cache */
+	hashx_cache* cache = hashx_cache_alloc(HASHX_INTERPRETED, 2);
+	assert(cache != NULL);
+	hashx_ctx* ctx1 = hashx_cache_get(cache, seed1, sizeof(seed1));
+	hashx_ctx* ctx2 = hashx_cache_get(cache, seed2, sizeof(seed2));
+	assert(ctx1 != NULL && ctx2 != NULL);
+	hashx_cache_release(cache, ctx1);
+	hashx_cache_release(cache, ctx2);
+	/* seed1 becomes the most recently used, so the next miss evicts seed2 */
+	ctx1 = hashx_cache_get(cache, seed1, sizeof(seed1));
+	hashx_cache_release(cache, ctx1);
+	int seed = 0;
+	ctx2 = hashx_cache_get(cache, &seed, sizeof(seed));
+	assert(ctx2 != NULL);
+	hashx_cache_release(cache, ctx2);
+	ctx1 = hashx_cache_get(cache, seed1, sizeof(seed1));
+	hashx_cache_release(cache, ctx1);
+	uint64_t hits, misses;
+	hashx_cache_stats(cache, &hits, &misses);
+	assert(hits == 2 && misses == 3);
+	assert(hashx_cache_size(cache) == 2);
+	hashx_cache_free(cache);
+	return true;
+}
+
+static bool test_cache2() {
+	char hashes[CACHE_SEEDS][HASHX_SIZE];
+	hashx_ctx* ctx = hashx_alloc(HASHX_INTERPRETED);
+	assert(ctx != NULL && ctx != HASHX_NOTSUPP);
+	for (int seed = 0; seed < CACHE_SEEDS; ++seed) {
+		if (hashx_make(ctx, &seed, sizeof(seed))) {
+			hash_test_input(ctx, hashes[seed]);
+		}
+	}
+	hashx_free(ctx);
+	/* smaller than the number of seeds to cause concurrent evictions */
+	hashx_cache* cache = hashx_cache_alloc(HASHX_INTERPRETED, 3);
+	assert(cache != NULL);
+	cache_job jobs[CACHE_THREADS];
+	hashx_thread threads[CACHE_THREADS];
+	for (int i = 0; i < CACHE_THREADS; ++i) {
+		jobs[i].cache = cache;
+		jobs[i].hashes = hashes;
+		threads[i] = hashx_thread_create(&cache_worker, &jobs[i]);
+	}
+	for (int i = 0; i < CACHE_THREADS; ++i) {
+		hashx_thread_join(threads[i]);
+		assert(jobs[i].ok);
+	}
+	uint64_t hits, misses;
+	hashx_cache_stats(cache, &hits, &misses);
+	assert(hits + misses == CACHE_THREADS * 100);
+	hashx_cache_free(cache);
+	return true;
+}
+
+#define MANY_SEEDS 64
+#define MANY_THREADS 4
+
+static bool test_make_many1() {
+	hashx_type type = ctx_cmp != HASHX_NOTSUPP ? HASHX_COMPILED
+		: HASHX_INTERPRETED;
+	hashx_ctx* ctxs[MANY_SEEDS];
+	int seed_values[MANY_SEEDS];
+	const void* seeds[MANY_SEEDS];
+	size_t seed_lens[MANY_SEEDS];
+	int status[MANY_SEEDS];
+	for (int i = 0; i < MANY_SEEDS; ++i) {
+		ctxs[i] = hashx_alloc(type);
+		assert(ctxs[i] != NULL && ctxs[i] != HASHX_NOTSUPP);
+		seed_values[i] = i;
+		seeds[i] = &seed_values[i];
+		seed_lens[i] = sizeof(seed_values[i]);
+	}
+	size_t made = hashx_make_many(ctxs, seeds, seed_lens, MANY_SEEDS,
+		status, MANY_THREADS);
+	size_t expected = 0;
+	hashx_ctx* ctx = hashx_alloc(HASHX_INTERPRETED);
+	assert(ctx != NULL && ctx != HASHX_NOTSUPP);
+	for (int i = 0; i < MANY_SEEDS; ++i) {
+		int ok = hashx_make(ctx, seeds[i], seed_lens[i]);
+		assert(status[i] == ok);
+		if (ok) {
+			char hash1[HASHX_SIZE];
+			char hash2[HASHX_SIZE];
+			hash_test_input(ctx, hash1);
+			hash_test_input(ctxs[i], hash2);
+			assert(hashes_equal(hash1, hash2));
+			expected++;
+		}
+		hashx_free(ctxs[i]);
+	}
+	hashx_free(ctx);
+	assert(made == expected);
+	return true;
+}
+
+static bool test_stats1() {
+	hashx_ctx* ctx = hashx_alloc(HASHX_INTERPRETED);
+	assert(ctx != NULL && ctx != HASHX_NOTSUPP);
+	hashx_program_info info;
+	assert(!hashx_query_program(ctx, &info));
+	/* this seed is rejected */
+	int seed = 1529;
+	assert(!hashx_make(ctx, &seed, sizeof(seed)));
+	assert(!hashx_query_program(ctx, &info));
+	assert(hashx_make(ctx, seed1, sizeof(seed1)));
+	assert(hashx_query_program(ctx, &info));
+	assert(info.code_size == 512);
+	assert(info.mul_count == 192);
+	assert(info.wide_mul_count <= info.mul_count);
+	assert(info.asic_latency > 0 && info.asic_latency <= info.code_size);
+	assert(info.cpu_latency > 0);
+	assert(info.x86_size > info.code_size);
+	hashx_stats stats;
+	char hash[HASHX_SIZE];
+	hash_test_input(ctx, hash);
+	hashx_stats_enable(ctx, 1);
+	for (int i = 0; i < 10; ++i) {
+		hash_test_input(ctx, hash);
+	}
+	hashx_query_stats(ctx, &stats);
+	assert(stats.makes == 1);
+	assert(stats.rejected == 1);
+	assert(stats.execs == 10);
+	hashx_free(ctx);
+	return true;
+}
+
+#define STATS_INPUTS 64
+
+static bool test_stats2() {
+	/* branches counted by every execution path must match the scalar
+	   interpreter */
+	hashx_ctx* ref = hashx_alloc(HASHX_INTERPRETED);
+	assert(ref != NULL && ref != HASHX_NOTSUPP);
+	assert(hashx_make(ref, seed1, sizeof(seed1)));
+	uint64_t expected = 0;
+	uint64_t nonces[STATS_INPUTS];
+	for (int i = 0; i < STATS_INPUTS; ++i) {
+		uint64_t r[8];
+		nonces[i] = i;
+#ifndef HASHX_BLOCK_MODE
+		hashx_siphash24_ctr_state512(&ref->keys, nonces[i], r);
+#else
+		hashx_blake2b_4r(&ref->params, &nonces[i], sizeof(nonces[i]), r);
+#endif
+		expected += hashx_program_execute_decoded(ref->decoded, r);
+	}
+	assert(expected > 0);
+	hashx_free(ref);
+	const hashx_type types[] = { HASHX_INTERPRETED, HASHX_COMPILED };
+	int type_count = ctx_cmp == HASHX_NOTSUPP ? 1 : 2;
+	for (int t = 0; t < type_count; ++t) {
+		hashx_ctx* ctx = hashx_alloc(types[t]);
+		assert(ctx != NULL && ctx != HASHX_NOTSUPP);
+		assert(hashx_make(ctx, seed1, sizeof(seed1)));
+		hashx_stats_enable(ctx, 1);
+		static char hashes[STATS_INPUTS][HASHX_SIZE];
+		for (int i = 0; i < STATS_INPUTS; ++i) {
+#ifndef HASHX_BLOCK_MODE
+			hashx_exec(ctx, nonces[i], hashes[i]);
+#else
+			hashx_exec(ctx, &nonces[i], sizeof(nonces[i]), hashes[i]);
+#endif
+		}
+		hashx_stats stats;
+		hashx_query_stats(ctx, &stats);
+		assert(stats.branches_taken == expected);
+#ifndef HASHX_BLOCK_MODE
+		hashx_exec_batch(ctx, nonces[0], STATS_INPUTS, hashes);
+#else
+		const void* inputs[STATS_INPUTS];
+		size_t sizes[STATS_INPUTS];
+		for (int i = 0; i < STATS_INPUTS; ++i) {
+			inputs[i] = &nonces[i];
+			sizes[i] = sizeof(nonces[i]);
+		}
+		hashx_exec_many(ctx, inputs, sizes, STATS_INPUTS, hashes);
+#endif
+		hashx_query_stats(ctx, &stats);
+		assert(stats.execs == 2 * STATS_INPUTS);
+		assert(stats.branches_taken == 2 * expected);
+		hashx_free(ctx);
+	}
+	return true;
+}
+
+static bool test_prefix1() {
+	/* prefix sizes around the BLAKE2b block size */
+	static const size_t prefix_sizes[] = { 0, 1, 127, 128, 129, 256, 300 };
+	uint8_t seed[310];
+	for (size_t i = 0; i < sizeof(seed); ++i) {
+		seed[i] = (uint8_t)(i * 7);
+	}
+	hashx_ctx* ctx1 = hashx_alloc(HASHX_INTERPRETED);
+	hashx_ctx* ctx2 = hashx_alloc(HASHX_INTERPRETED);
+	hashx_prefix* prefix = hashx_prefix_alloc();
+	assert(ctx1 != NULL && ctx1 != HASHX_NOTSUPP);
+	assert(ctx2 != NULL && ctx2 != HASHX_NOTSUPP);
+	assert(prefix != NULL);
+	for (size_t i = 0; i < sizeof(prefix_sizes) / sizeof(prefix_sizes[0]); ++i) {
+		size_t size = prefix_sizes[i];
+		hashx_prefix_set(prefix, seed, size);
+		for (size_t suffix = 0; suffix <= 10; suffix += 5) {
+			int ok1 = hashx_make(ctx1, seed, size + suffix);
+			int ok2 = hashx_make_prefix(ctx2, prefix, seed + size, suffix);
+			assert(ok1 == ok2);
+			if (ok1) {
+				char hash1[HASHX_SIZE];
+				char hash2[HASHX_SIZE];
+				hash_test_input(ctx1, hash1);
+				hash_test_input(ctx2, hash2);
+				assert(hashes_equal(hash1, hash2));
+			}
+		}
+	}
+	hashx_prefix_free(prefix);
+	hashx_free(ctx1);
+	hashx_free(ctx2);
+	return true;
+}
+
 static bool test_compiler_block1() {
 	if (ctx_cmp == HASHX_NOTSUPP)
 		return false;
@@ -198,7 +791,90 @@ static bool test_compiler_block1() {
 #endif
 }
 
-int main() {
+static bool test_exec_many1() {
+#ifndef HASHX_BLOCK_MODE
+	return false;
+#else
+	/* inputs of different sizes, including empty and multi-block ones */
+	static unsigned char data[BATCH_SIZE + 400];
+	const void* inputs[BATCH_SIZE];
+	size_t sizes[BATCH_SIZE];
+	for (int i = 0; i < (int)sizeof(data); ++i) {
+		data[i] = (unsigned char)(i * 7);
+	}
+	for (int i = 0; i < BATCH_SIZE; ++i) {
+		inputs[i] = data + i;
+		sizes[i] = (size_t)(i * 131) % 400;
+	}
+	hashx_ctx* ctxs[] = { ctx_int, ctx_cmp };
+	for (int c = 0; c < 2; ++c) {
+		if (ctxs[c] == HASHX_NOTSUPP)
+			continue;
+		char hashes[BATCH_SIZE * HASHX_SIZE];
+		hashx_exec_many(ctxs[c], inputs, sizes, BATCH_SIZE, hashes);
+		for (int i = 0; i < BATCH_SIZE; ++i) {
+			char hash[HASHX_SIZE];
+			hashx_exec(ctxs[c], inputs[i], sizes[i], hash);
+			assert(hashes_equal(hash, &hashes[i * HASHX_SIZE]));
+		}
+	}
+	return true;
+#endif
+}
+
+static bool test_stream1() {
+#ifndef HASHX_BLOCK_MODE
+	return false;
+#else
+	/* fragments that split Blake2b blocks at different offsets */
+	static unsigned char data[700];
+	static const size_t splits[][3] = {
+		{ 0, 0, 0 }, { 1, 2, 3 }, { 76, 52, 128 }, { 128, 0, 129 },
+		{ 127, 256, 300 }, { 0, 700, 0 }, { 300, 10, 390 },
+	};
+	for (int i = 0; i < (int)sizeof(data); ++i) {
+		data[i] = (unsigned char)(i * 13);
+	}
+	hashx_stream* stream = hashx_stream_alloc();
+	assert(stream != NULL);
+	hashx_ctx* ctxs[] = { ctx_int, ctx_cmp };
+	for (int c = 0; c < 2; ++c) {
+		if (ctxs[c] == HASHX_NOTSUPP)
+			continue;
+		for (int i = 0; i < sizeof(splits) / sizeof(splits[0]); ++i) {
+			hashx_iovec iov[3];
+			size_t offset = 0;
+			for (int j = 0; j < 3; ++j) {
+				iov[j].base = data + offset;
+				iov[j].size = splits[i][j];
+				offset += splits[i][j];
+			}
+			char hash1[HASHX_SIZE];
+			char hash2[HASHX_SIZE];
+			char hash3[HASHX_SIZE];
+			hashx_exec(ctxs[c], data, offset, hash1);
+			hashx_exec_iov(ctxs[c], iov, 3, hash2);
+			assert(hashes_equal(hash1, hash2));
+			hashx_stream_init(stream, ctxs[c]);
+			for (int j = 0; j < 3; ++j) {
+				hashx_stream_update(stream, iov[j].base, iov[j].size);
+			}
+			hashx_stream_final(stream, hash3);
+			assert(hashes_equal(hash1, hash3));
+		}
+		char hash1[HASHX_SIZE];
+		char hash2[HASHX_SIZE];
+		hashx_exec(ctxs[c], data, 0, hash1);
+		hashx_exec_iov(ctxs[c], NULL, 0, hash2);
+		assert(hashes_equal(hash1, hash2));
+	}
+	hashx_stream_free(stream);
+	return true;
+#endif
+}
+
+int main(int argc, char** argv) {
+	read_int_option("--generator-seeds", argc, argv, &generator_seeds, 10000);
 	RUN_TEST(test_alloc);
 	RUN_TEST(test_make1);
 	RUN_TEST(test_hash_ctr1);
@@ -210,8 +886,27 @@ int main() {
 	RUN_TEST(test_make3);
 	RUN_TEST(test_compiler_ctr1);
 	RUN_TEST(test_compiler_ctr2);
+	RUN_TEST(test_batch_ctr1);
+	RUN_TEST(test_batch_ctr2);
+	RUN_TEST(test_search_ctr1);
+	RUN_TEST(test_compiler_batch1);
 	RUN_TEST(test_hash_block1);
 	RUN_TEST(test_compiler_block1);
+	RUN_TEST(test_exec_many1);
+	RUN_TEST(test_stream1);
+	RUN_TEST(test_arena1);
+	RUN_TEST(test_generator1);
+	RUN_TEST(test_generate1);
+	RUN_TEST(test_interpreter1);
+	RUN_TEST(test_cache1);
+	RUN_TEST(test_cache2);
+	RUN_TEST(test_cache3);
+	RUN_TEST(test_make_many1);
+	RUN_TEST(test_stats1);
+	RUN_TEST(test_stats2);
+	RUN_TEST(test_prefix1);
+	RUN_TEST(test_clone1);
+	RUN_TEST(test_blake2b1);
 	RUN_TEST(test_free);
 	
 	printf("\nAll tests were successful\n");
@@ -1,6 +1,8 @@
 /* Copyright (c) 2020 tevador <tevador@gmail.com> */
 /* See LICENSE for licensing information */
 
+#include <stdlib.h>
+
 #include "virtual_memory.h"
 
 #ifdef HASHX_WIN
@@ -11,9 +13,16 @@
 #endif
 #include <sys/types.h>
 #include <sys/mman.h>
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/syscall.h>
+#endif
 #ifndef MAP_ANONYMOUS
 #define MAP_ANONYMOUS MAP_ANON
 #endif
+#ifndef MAP_POPULATE
+#define MAP_POPULATE 0
+#endif
 #define PAGE_READONLY PROT_READ
 #define PAGE_READWRITE (PROT_READ | PROT_WRITE)
 #define PAGE_EXECUTE_READ (PROT_READ | PROT_EXEC)
@@ -64,6 +73,40 @@ void* hashx_vm_alloc(size_t bytes) {
 	return mem;
 }
 
+/*
+ * Maps the same memory twice: the returned mapping is executable and
+ * the mapping stored in rw_alias is writable, so code can be updated
+ * without changing page protection. Returns NULL if not supported.
+ */
+void* hashx_vm_alloc_dual(size_t bytes, void** rw_alias) {
+#if defined(__linux__) && defined(SYS_memfd_create)
+	int fd = (int)syscall(SYS_memfd_create, "hashx", 1 /* MFD_CLOEXEC */);
+	if (fd < 0) {
+		return NULL;
+	}
+	void* rx = MAP_FAILED;
+	void* rw = MAP_FAILED;
+	if (ftruncate(fd, (off_t)bytes) == 0) {
+		rw = mmap(NULL, bytes, PAGE_READWRITE, MAP_SHARED, fd, 0);
+		rx = mmap(NULL, bytes, PAGE_EXECUTE_READ, MAP_SHARED, fd, 0);
+	}
+	close(fd);
+	if (rw == MAP_FAILED || rx == MAP_FAILED) {
+		if (rw != MAP_FAILED)
+			munmap(rw, bytes);
+		if (rx != MAP_FAILED)
+			munmap(rx, bytes);
+		return NULL;
+	}
+	*rw_alias = rw;
+	return rx;
+#else
+	(void)bytes;
+	(void)rw_alias;
+	return NULL;
+#endif
+}
+
 static inline int page_protect(void* ptr, size_t bytes, int rules) {
 #ifdef HASHX_WIN
 	DWORD oldp;
@@ -124,3 +167,132 @@ void hashx_vm_free(void* ptr, size_t bytes) {
 	munmap(ptr, bytes);
 #endif
 }
+
+/* A contiguous mapping that is divided into code slots. */
+typedef struct arena_region {
+	struct arena_region* next;
+	uint8_t* mem;
+	size_t size;
+} arena_region;
+
+struct hashx_arena {
+	size_t slot_size;
+	size_t region_slots;
+	arena_region* regions;
+	void** free_slots;
+	size_t num_free;
+	size_t num_slots;
+	bool writable;
+};
+
+static bool arena_grow(hashx_arena* arena) {
+	size_t num_slots = arena->num_slots + arena->region_slots;
+	void** free_slots = realloc(arena->free_slots, num_slots * sizeof(void*));
+	if (free_slots == NULL) {
+		return false;
+	}
+	arena->free_slots = free_slots;
+	arena_region* region = malloc(sizeof(arena_region));
+	if (region == NULL) {
+		return false;
+	}
+	region->size = arena->slot_size * arena->region_slots;
+#ifdef HASHX_WIN
+	region->mem = VirtualAlloc(NULL, region->size, MEM_COMMIT, PAGE_READWRITE);
+#else
+	/* pre-fault the pages so that compiling into a new slot doesn't cause
+	   page faults */
+	region->mem = mmap(NULL, region->size, PAGE_READWRITE, MAP_ANONYMOUS
+		| MAP_PRIVATE | MAP_POPULATE, -1, 0);
+	if (region->mem == MAP_FAILED) {
+		region->mem = NULL;
+	}
+#endif
+	if (region->mem == NULL) {
+		free(region);
+		return false;
+	}
+	/* Idle slots are kept executable, so a region is a single mapping
+	   with uniform protection unless a slot is being written. */
+	if (!arena->writable) {
+		page_protect(region->mem, region->size, PAGE_EXECUTE_READ);
+	}
+	region->next = arena->regions;
+	arena->regions = region;
+	for (size_t i = arena->region_slots; i > 0; --i) {
+		arena->free_slots[arena->num_free++] =
+			region->mem + (i - 1) * arena->slot_size;
+	}
+	arena->num_slots = num_slots;
+	return true;
+}
+
+hashx_arena* hashx_vm_arena_create(size_t slot_size, size_t region_slots) {
+	hashx_arena* arena = malloc(sizeof(hashx_arena));
+	if (arena == NULL) {
+		return NULL;
+	}
+	arena->slot_size = slot_size;
+	arena->region_slots = region_slots > 0 ? region_slots : 1;
+	arena->regions = NULL;
+	arena->free_slots = NULL;
+	arena->num_free = 0;
+	arena->num_slots = 0;
+	arena->writable = false;
+	if (!arena_grow(arena)) {
+		hashx_vm_arena_destroy(arena);
+		return NULL;
+	}
+	return arena;
+}
+
+void* hashx_vm_arena_take(hashx_arena* arena) {
+	if (arena->num_free == 0 && !arena_grow(arena)) {
+		return NULL;
+	}
+	return arena->free_slots[--arena->num_free];
+}
+
+void hashx_vm_arena_give(hashx_arena* arena, void* slot) {
+	arena->free_slots[arena->num_free++] = slot;
+}
+
+void hashx_vm_arena_slot_rw(hashx_arena* arena, void* slot) {
+	if (!arena->writable) {
+		page_protect(slot, arena->slot_size, PAGE_READWRITE);
+	}
+}
+
+void hashx_vm_arena_slot_rx(hashx_arena* arena, void* slot) {
+	if (!arena->writable) {
+		page_protect(slot, arena->slot_size, PAGE_EXECUTE_READ);
+	}
+}
+
+void hashx_vm_arena_rw(hashx_arena* arena) {
+	for (arena_region* region = arena->regions; region != NULL;
+		region = region->next) {
+		page_protect(region->mem, region->size, PAGE_READWRITE);
+	}
+	arena->writable = true;
+}
+
+void hashx_vm_arena_rx(hashx_arena* arena) {
+	for (arena_region* region = arena->regions; region != NULL;
+		region = region->next) {
+		page_protect(region->mem, region->size, PAGE_EXECUTE_READ);
+	}
+	arena->writable = false;
+}
+
+void hashx_vm_arena_destroy(hashx_arena* arena) {
+	arena_region* region = arena->regions;
+	while (region != NULL) {
+		arena_region* next = region->next;
+		hashx_vm_free(region->mem, region->size);
+		free(region);
+		region = next;
+	}
+	free(arena->free_slots);
+	free(arena);
+}
@@ -6,14 +6,28 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include <stdbool.h>
 #include <hashx.h>
 
 #define ALIGN_SIZE(pos, align) ((((pos) - 1) / (align) + 1) * (align))
 
 HASHX_PRIVATE void* hashx_vm_alloc(size_t size);
+HASHX_PRIVATE void* hashx_vm_alloc_dual(size_t size, void** rw_alias);
 HASHX_PRIVATE void hashx_vm_rw(void* ptr, size_t size);
 HASHX_PRIVATE void hashx_vm_rx(void* ptr, size_t size);
 HASHX_PRIVATE void* hashx_vm_alloc_huge(size_t size);
 HASHX_PRIVATE void hashx_vm_free(void* ptr, size_t size);
 
+/* Code arena: fixed-size slots carved from large shared mappings. Slots
+   are executable unless they are being written. */
+HASHX_PRIVATE hashx_arena* hashx_vm_arena_create(size_t slot_size,
+	size_t region_slots);
+HASHX_PRIVATE void* hashx_vm_arena_take(hashx_arena* arena);
+HASHX_PRIVATE void hashx_vm_arena_give(hashx_arena* arena, void* slot);
+HASHX_PRIVATE void hashx_vm_arena_slot_rw(hashx_arena* arena, void* slot);
+HASHX_PRIVATE void hashx_vm_arena_slot_rx(hashx_arena* arena, void* slot);
+HASHX_PRIVATE void hashx_vm_arena_rw(hashx_arena* arena);
+HASHX_PRIVATE void hashx_vm_arena_rx(hashx_arena* arena);
+HASHX_PRIVATE void hashx_vm_arena_destroy(hashx_arena* arena);
+
 #endif